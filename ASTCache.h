@@ -0,0 +1,95 @@
+//==--- ASTCache.h - On-disk cache of checked ASTs keyed by source hash ---===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/Version.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Serialization/PCHContainerOperations.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace clang;
+
+/// 把经过 Sema 检查的 AST 序列化到缓存目录里，之后同样的源码直接反序列化，不再重新解析
+/// 缓存键是源码、编译参数和 clang 版本的哈希
+///
+/// 源码只存在于 tooling 的内存文件系统里，磁盘上没有 input.cc，
+/// 所以解析时带上 -fmodules-embed-all-files，把源码本身写进 AST 文件：
+/// 加载时不再拿磁盘上的文件校验，行号等源码位置也能从嵌入的内容里算出来
+class ASTCache {
+    std::string mDir;
+    std::vector<std::string> mArgs;
+
+    std::string path(const std::string &code) {
+        std::string key = code;
+        key.push_back('\0');
+        for (const std::string &arg : mArgs) {
+            key.append(arg);
+            key.push_back('\0');
+        }
+        key.append(getClangFullVersion());
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.ast", (unsigned long long) llvm::xxHash64(key));
+        llvm::SmallString<256> file(mDir);
+        llvm::sys::path::append(file, name);
+        return file.str().str();
+    }
+
+public:
+    /// 缓存目录由 AST_INTERPRETER_CACHE 指定，否则放在系统的缓存目录下
+    static std::string defaultDir() {
+        if (const char *dir = getenv("AST_INTERPRETER_CACHE"))
+            return dir;
+        llvm::SmallString<256> dir;
+        if (!llvm::sys::path::cache_directory(dir))
+            return "";
+        llvm::sys::path::append(dir, "ast-interpreter");
+        return dir.str().str();
+    }
+
+    explicit ASTCache(const std::string &dir, const std::vector<std::string> &args = std::vector<std::string>())
+            : mDir(dir), mArgs(args) {
+        mArgs.push_back("-Xclang");
+        mArgs.push_back("-fmodules-embed-all-files");
+    }
+
+    /// 命中缓存时直接加载，否则解析源码并写入缓存，出错的 AST 不缓存
+    std::unique_ptr<ASTUnit> load(const std::string &code) {
+        if (mDir.empty())
+            return tooling::buildASTFromCodeWithArgs(code, mArgs);
+
+        std::string file = path(code);
+        if (llvm::sys::fs::exists(file)) {
+            RawPCHContainerReader reader;
+            /// 加载失败时重新解析就是了，读取器的诊断不能混进被解释程序的输出
+            IntrusiveRefCntPtr<DiagnosticsEngine> diags =
+                    CompilerInstance::createDiagnostics(new DiagnosticOptions(), new IgnoringDiagConsumer());
+#if CLANG_VERSION_MAJOR >= 17
+            std::unique_ptr<ASTUnit> ast = ASTUnit::LoadFromASTFile(file, reader, ASTUnit::LoadEverything, diags,
+                                                                    FileSystemOptions(),
+                                                                    std::make_shared<HeaderSearchOptions>());
+#else
+            std::unique_ptr<ASTUnit> ast = ASTUnit::LoadFromASTFile(file, reader, ASTUnit::LoadEverything, diags,
+                                                                    FileSystemOptions());
+#endif
+            if (ast)
+                return ast;
+        }
+
+        std::unique_ptr<ASTUnit> ast = tooling::buildASTFromCodeWithArgs(code, mArgs);
+        if (ast && !ast->getDiagnostics().hasErrorOccurred() && !llvm::sys::fs::create_directories(mDir)) {
+            /// Save 先写临时文件再改名，并发运行时不会读到写了一半的缓存
+            ast->Save(file);
+        }
+        return ast;
+    }
+};
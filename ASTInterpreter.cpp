@@ -2,269 +2,615 @@
 //===----------------------------------------------------------------------===//
 
 #include "clang/AST/ASTConsumer.h"
-#include "clang/AST/EvaluatedExprVisitor.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/xxhash.h"
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
 
 using namespace clang;
 
 #include "Environment.h"
+#include "Compiler.h"
+#include "VM.h"
+#include "ASTCache.h"
+#include "Coverage.h"
 
-class InterpreterVisitor :
-        public EvaluatedExprVisitor<InterpreterVisitor> {
-public:
-    explicit InterpreterVisitor(const ASTContext &context, Environment *env)
-            : EvaluatedExprVisitor(context), mEnv(env) {}
-
-    virtual ~InterpreterVisitor() {}
+/// 命令行选项
+struct Options {
+    /// 从 AST 缓存加载
+    bool cache = true;
+    /// 统计每个函数的耗时，结束时输出报告
+    bool profile = false;
+    /// 不为空时把 folded 调用栈写到这个文件里
+    std::string profileOutput;
+    /// 定时采样正在执行的源码行，结束时输出热点
+    bool sample = false;
+    /// 不为空时把采样到的 folded 调用栈写到这个文件里
+    std::string sampleOutput;
+    /// 每秒 CPU 时间采样的次数
+    long sampleHz = 1000;
+    /// 函数被调用这么多次以后编译成本地代码，0 表示不编译
+    unsigned jitThreshold = 1000;
+    /// 被解释程序的最大调用深度
+    int64_t maxDepth = VM::kDefaultMaxDepth;
+    /// PRINT 的输出目的地：stderr、stdout 或者文件路径
+    std::string output = "stderr";
+    /// GET 的输入文件，"-" 表示一次读完标准输入，为空时交互地读
+    std::string input;
+    /// 结束时输出内存使用报告
+    bool memoryReport = false;
+    /// 不为空时把内存报告写到这个文件里，否则写到 stderr
+    std::string memoryReportOutput;
+    /// CHECKPOINT() 和 SIGUSR1 把执行状态保存到这个文件，为空时不保存
+    std::string checkpoint;
+    /// 不为空时从这个检查点继续执行，而不是从 main 开始
+    std::string restore;
+    /// 递归纯函数的结果缓存的条目数，0 表示不缓存
+    /// 默认关闭：没有重叠子问题的递归查表只会变慢，被缓存的函数也不能交给 JIT
+    uint64_t memo = 0;
+    /// 结束时输出结果缓存的命中率
+    bool memoStats = false;
+    /// 记录最近解释执行的这么多条指令，出错时输出，0 表示不记录；需要用 ENABLE_TRACE 编译
+    uint64_t trace = 0;
+    /// 不为空时统计每条语句和每个分支执行的次数，结束时把 lcov 格式的报告写到这个文件
+    std::string coverage;
+    /// 报告里 SF 记录的源文件路径，源码是从命令行传进来时解释器不知道它的文件名，为空时写 input.c
+    std::string coverageSource;
+    /// 源码的哈希，interpret 填写，检查点只能用同一份源码恢复
+    uint64_t program = 0;
+};
 
-    virtual void VisitBinaryOperator(BinaryOperator *bop) {
-        int depth = mEnv->getCurrentDepth();
-        for (auto *SubStmt: bop->children()) {
-            if (SubStmt) {
-                Visit(SubStmt);
-                if (depth != mEnv->getCurrentDepth())
-                    return;
-            }
-        }
-        mEnv->binOp(bop);
+class InterpreterConsumer : public ASTConsumer {
+public:
+    InterpreterConsumer(const ASTContext &context, OutputSink &out, InputProvider &in, const Options &options = Options())
+            : mEnv(out, in), mCompiler(&mEnv), mVM(&mEnv, &mCompiler), mOptions(options), mExecSeconds(0) {
     }
 
-    // 字面量整型没有子语句，所以不用 VisitStmt()
-    virtual void VisitIntegerLiteral(IntegerLiteral *integer) {
-        mEnv->integer(integer);
-    }
+    virtual ~InterpreterConsumer() {}
 
-    virtual void VisitUnaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr *expr) {
-        mEnv->ueot(expr);
-    }
+    virtual void HandleTranslationUnit(clang::ASTContext &Context) {
+        TranslationUnitDecl *decl = Context.getTranslationUnitDecl();
+        if (mOptions.memoryReport)
+            mEnv.getMemoryStats().enable();
+        mEnv.init(decl);
+        mCompiler.analyze(decl);
+        /// 计数器也会编译进本地代码，不需要关掉 JIT
+        mCompiler.setCoverage(!mOptions.coverage.empty());
+        mVM.setMaxDepth(mOptions.maxDepth);
 
-    virtual void VisitParenExpr(ParenExpr *expr) {
-        int depth = mEnv->getCurrentDepth();
-        for (auto *SubStmt: expr->children()) {
-            if (SubStmt) {
-                Visit(SubStmt);
-                if (depth != mEnv->getCurrentDepth())
-                    return;
-            }
+        std::unique_ptr<Profiler> profiler;
+        std::unique_ptr<Sampler> sampler;
+        if (mOptions.sample)
+            sampler.reset(new Sampler(std::max(1L, 1000000 / std::max(1L, mOptions.sampleHz))));
+        if (mOptions.profile) {
+            profiler.reset(new Profiler());
+            mVM.setProfiler(profiler.get());
+        } else if (!mOptions.memoryReport && !sampler) {
+            /// 本地代码的调用不经过虚拟机，统计不到调用深度，也不会响应采样
+            mVM.setJITThreshold(mOptions.jitThreshold);
+        }
+        if (!mOptions.checkpoint.empty())
+            mVM.setCheckpoint(mOptions.checkpoint, mOptions.program);
+        std::unique_ptr<MemoCache> memo;
+        if (mOptions.memo) {
+            memo.reset(new MemoCache(mOptions.memo));
+            mVM.setMemoCache(memo.get());
         }
-        mEnv->paren(expr);
-    }
 
-    virtual void VisitDeclRefExpr(DeclRefExpr *expr) {
-        int depth = mEnv->getCurrentDepth();
-        for (auto *SubStmt: expr->children()) {
-            if (SubStmt) {
-                Visit(SubStmt);
-                if (depth != mEnv->getCurrentDepth())
-                    return;
+        auto start = std::chrono::steady_clock::now();
+        if (sampler)
+            mVM.setSampler(sampler.get());
+#ifdef AST_INTERPRETER_TRACE
+        std::unique_ptr<Trace> trace;
+        if (mOptions.trace) {
+            trace.reset(new Trace(mOptions.trace));
+            mVM.setTrace(trace.get());
+        }
+        try {
+            execute();
+        } catch (std::exception &) {
+            /// 异常最后可能走到 std::terminate，先让 Trace 不再响应信号，不然 SIGABRT 会再打印一遍
+            mVM.setTrace(NULL);
+            if (trace) {
+                mEnv.flushOutput();
+                trace->dump();
+                trace.reset();
             }
+            throw;
         }
-        mEnv->declRef(expr);
-    }
+        mVM.setTrace(NULL);
+#else
+        execute();
+#endif
+        mExecSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (sampler)
+            mVM.setSampler(NULL);
 
-    virtual void VisitIfStmt(IfStmt *stmt) {
-        Expr *cond = stmt->getCond();
-        int depth = mEnv->getCurrentDepth();
-        Visit(cond);
-        if (depth != mEnv->getCurrentDepth())
-            return;
-        if (mEnv->getStmtVal(cond)) {
-            Visit(stmt->getThen());
-        } else {
-            // 需要手动处理没有 Else 分支的情况
-            if (Stmt *elseStmt = stmt->getElse()) {
-                Visit(elseStmt);
+        if (profiler) {
+            mVM.setProfiler(NULL);
+            profiler->report(llvm::errs());
+            if (!mOptions.profileOutput.empty()) {
+                writeReport(mOptions.profileOutput, [&](llvm::raw_ostream &out) {
+                    profiler->writeFolded(out);
+                });
+            }
+        }
+        if (sampler) {
+            sampler->report(llvm::errs());
+            if (!mOptions.sampleOutput.empty()) {
+                writeReport(mOptions.sampleOutput, [&](llvm::raw_ostream &out) {
+                    sampler->writeFolded(out);
+                });
             }
         }
+        if (memo) {
+            mVM.setMemoCache(NULL);
+            if (mOptions.memoStats)
+                memo->report(llvm::errs());
+        }
+        if (mOptions.memoryReport)
+            reportMemory();
+        if (!mOptions.coverage.empty())
+            reportCoverage();
     }
 
-    virtual void VisitWhileStmt(WhileStmt *stmt) {
-        Expr *cond = stmt->getCond();
-        int depth = mEnv->getCurrentDepth();
-        Visit(cond);
-        if (depth != mEnv->getCurrentDepth())
-            return;
-        while (mEnv->getStmtVal(cond)) {
-            Visit(stmt->getBody());
-            if (depth != mEnv->getCurrentDepth())
-                return;
-            Visit(cond);
-            if (depth != mEnv->getCurrentDepth())
-                return;
-        }
+    /// 降级和执行一共花的时间
+    double getExecSeconds() {
+        return mExecSeconds;
     }
 
-    virtual void VisitForStmt(ForStmt *stmt) {
-        int depth = mEnv->getCurrentDepth();
-        if (stmt->getInit()) {
-            Visit(stmt->getInit());
-            if (depth != mEnv->getCurrentDepth())
-                return;
-        }
-        Expr *cond = stmt->getCond();
-        Stmt *body = stmt->getBody();
-        Expr *inc = stmt->getInc();
-        if (cond) {
-            Visit(cond);
-            if (depth != mEnv->getCurrentDepth())
-                return;
-            while (mEnv->getStmtVal(cond)) {
-                if (body) {
-                    Visit(body);
-                    if (depth != mEnv->getCurrentDepth())
-                        return;
-                }
-                if (inc) {
-                    Visit(inc);
-                    if (depth != mEnv->getCurrentDepth())
-                        return;
-                }
-                Visit(cond);
-                if (depth != mEnv->getCurrentDepth())
-                    return;
-            }
-        } else {
-            throw std::exception();
-        }
+    uint64_t getSteps() {
+        return mVM.getSteps();
     }
 
-    virtual void VisitArraySubscriptExpr(ArraySubscriptExpr *expr) {
-        int depth = mEnv->getCurrentDepth();
-        for (auto *SubStmt: expr->children()) {
-            if (SubStmt) {
-                Visit(SubStmt);
-                if (depth != mEnv->getCurrentDepth())
-                    return;
-            }
+private:
+    /// 把报告写到 path，path 为空时写到 stderr；文件打不开时只报错，不影响程序的结果
+    static void writeReport(const std::string &path, const std::function<void(llvm::raw_ostream &)> &write) {
+        if (path.empty()) {
+            write(llvm::errs());
+            return;
+        }
+        std::error_code ec;
+        llvm::raw_fd_ostream file(path, ec);
+        if (ec) {
+            llvm::errs() << path << ": " << ec.message() << "\n";
+            return;
         }
-        mEnv->arraySubscript(expr);
+        write(file);
     }
 
-    virtual void VisitUnaryOperator(UnaryOperator *oper) {
-        int depth = mEnv->getCurrentDepth();
-        for (auto *SubStmt: oper->children()) {
-            if (SubStmt) {
-                Visit(SubStmt);
-                if (depth != mEnv->getCurrentDepth())
-                    return;
-            }
+    /// 从 main 开始，或者从检查点继续
+    void execute() {
+        if (!mOptions.restore.empty()) {
+            mVM.resume(mOptions.restore, mOptions.program);
+        } else {
+            FunctionDecl *entry = mEnv.getEntry();
+            mVM.run(mCompiler.getFunction(entry));
         }
-        mEnv->unaryOp(oper);
     }
 
-    /// 常见错误情况是死循环
-    /// 光赋值返回值还不够，应该让这一层函数的所有语句立即返回
-    /// 错误情况是例如return语句是if的分支，则if语句里的VisitStmt都会执行完即使应该返回了
-    /// 这会导致本该返回的函数继续执行下面的语句，其中就有了call语句
-    /// 修复方法是在访问子语句前获取一次调用深读，访问之后再获取一次并比对是否一样
-    virtual void VisitReturnStmt(ReturnStmt *stmt) {
-        int depth = mEnv->getCurrentDepth();
-        for (auto *SubStmt: stmt->children()) {
-            if (SubStmt) {
-                Visit(SubStmt);
-                if (depth != mEnv->getCurrentDepth())
-                    return;
-            }
+    /// 没有调用过的函数这时才降级，它们的计数都是 0
+    void reportCoverage() {
+        Coverage coverage;
+        for (auto &it : mEnv.getFunctions()) {
+            if (it.second->hasBody())
+                coverage.add(mCompiler.getFunction(it.second));
         }
-        mEnv->returnStmt(stmt);
+        writeReport(mOptions.coverage, [&](llvm::raw_ostream &out) {
+            coverage.writeLcov(out, mOptions.coverageSource.empty() ? "input.c" : mOptions.coverageSource);
+        });
     }
 
-    virtual void VisitCastExpr(CastExpr *expr) {
-        int depth = mEnv->getCurrentDepth();
-        for (auto *SubStmt: expr->children()) {
-            if (SubStmt) {
-                Visit(SubStmt);
-                if (depth != mEnv->getCurrentDepth())
-                    return;
-            }
-        }
-        mEnv->cast(expr);
+    void reportMemory() {
+        writeReport(mOptions.memoryReportOutput, [&](llvm::raw_ostream &out) {
+            mEnv.getMemoryStats().report(out, mEnv.getMemory().used(), mVM.getPeakDepth(), mVM.getPeakStack(),
+                                         mVM.getPeakArrays());
+        });
     }
 
-    virtual void VisitCallExpr(CallExpr *call) {
-        int depth = mEnv->getCurrentDepth();
-        Expr **args = call->getArgs();
-        for (int i = 0; i < call->getNumArgs(); i++) {
-            Visit(args[i]);
-            if (depth != mEnv->getCurrentDepth())
-                return;
-        }
-        if (mEnv->call(call)) {
-            depth = mEnv->getCurrentDepth();
-            FunctionDecl *entry = mEnv->getEntry();
-            for (auto *SubStmt: entry->getBody()->children()) {
-                if (SubStmt) {
-                    Visit(SubStmt);
-                    if (depth != mEnv->getCurrentDepth())
-                        return;
-                }
-            }
-            if (call->getDirectCallee()->getReturnType()->isVoidType())
-                mEnv->popStackFrame();
-        }
+    Environment mEnv;
+    Compiler mCompiler;
+    VM mVM;
+    Options mOptions;
+    double mExecSeconds;
+};
+
+class InterpreterClassAction : public ASTFrontendAction {
+public:
+    InterpreterClassAction(OutputSink &out, InputProvider &in, const Options &options)
+            : mOut(out), mIn(in), mOptions(options) {
     }
 
-    virtual void VisitDeclStmt(DeclStmt *declstmt) {
-        mEnv->decl(declstmt);
+    virtual std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(
+            clang::CompilerInstance &Compiler, llvm::StringRef InFile) {
+        return std::make_unique<InterpreterConsumer>(Compiler.getASTContext(), mOut, mIn, mOptions);
     }
 
 private:
-    Environment *mEnv;
+    OutputSink &mOut;
+    InputProvider &mIn;
+    Options mOptions;
 };
 
-class InterpreterConsumer : public ASTConsumer {
-public:
-    explicit InterpreterConsumer(const ASTContext &context) : mEnv(),
-                                                              mVisitor(context, &mEnv) {
+
+/// 默认从 AST 缓存里加载，--no-cache 时每次都重新解析
+static void interpret(const std::string &code, const Options &defaults, OutputSink &out, InputProvider &in) {
+    Options options = defaults;
+    /// 覆盖率计数器会改变字节码的 pc，开没开覆盖率的检查点不能混用
+    options.program = llvm::xxHash64(code) ^ !options.coverage.empty();
+    if (!options.cache) {
+        clang::tooling::runToolOnCode(
+                std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction(out, in, options)), code);
+        return;
     }
+    std::unique_ptr<ASTUnit> ast = ASTCache(ASTCache::defaultDir()).load(code);
+    if (!ast)
+        return;
+    InterpreterConsumer consumer(ast->getASTContext(), out, in, options);
+    consumer.HandleTranslationUnit(ast->getASTContext());
+}
 
-    virtual ~InterpreterConsumer() {}
+/// 没有指定 --input 时交互地读，打不开时抛出异常
+/// 批量运行时每个程序各自打开一次，同一个输入文件对每个程序都从头读起；
+/// 标准输入只能读一次，由调用者先读出来放在 contents 里，每个程序共用
+static std::unique_ptr<InputProvider> openInput(const Options &options,
+                                                const std::shared_ptr<const std::string> &contents = NULL) {
+    if (contents)
+        return std::unique_ptr<InputProvider>(new InputProvider(contents));
+    if (options.input.empty())
+        return std::unique_ptr<InputProvider>(new InputProvider());
+    return std::unique_ptr<InputProvider>(new InputProvider(options.input));
+}
 
-    virtual void HandleTranslationUnit(clang::ASTContext &Context) {
-        TranslationUnitDecl *decl = Context.getTranslationUnitDecl();
-        mEnv.init(decl);
+/// 参数是文件或者目录，目录下的所有 .c 文件按名字排序
+static std::vector<std::string> collectFiles(const std::vector<std::string> &paths) {
+    std::vector<std::string> files;
+    for (const std::string &path : paths) {
+        if (!llvm::sys::fs::is_directory(path)) {
+            files.push_back(path);
+            continue;
+        }
+        std::vector<std::string> entries;
+        std::error_code ec;
+        for (llvm::sys::fs::directory_iterator it(path, ec), end; it != end && !ec; it.increment(ec)) {
+            if (llvm::sys::path::extension(it->path()) == ".c")
+                entries.push_back(it->path());
+        }
+        std::sort(entries.begin(), entries.end());
+        files.insert(files.end(), entries.begin(), entries.end());
+    }
+    return files;
+}
 
-        FunctionDecl *entry = mEnv.getEntry();
-        int depth = mEnv.getCurrentDepth();
-        for (auto *SubStmt: entry->getBody()->children()) {
-            if (SubStmt) {
-                mVisitor.Visit(SubStmt);
-                if (depth != mEnv.getCurrentDepth())
-                    return;
-            }
+/// 批量模式：每个程序在线程池里独立运行，输出分别收集，最后按输入顺序每行输出一个 JSON 结果
+static int runBatch(const std::vector<std::string> &paths, unsigned jobs, const Options &options) {
+    std::vector<std::string> files = collectFiles(paths);
+    /// 工作线程不能各自读标准输入，交互模式的 scanf 也会互相抢输入，
+    /// 所以 --input=- 在这里一次读完，没有指定 --input 时 GET 没有输入，返回 0
+    std::shared_ptr<const std::string> contents;
+    if (options.input.empty()) {
+        contents = std::make_shared<const std::string>();
+    } else if (options.input == "-") {
+        try {
+            contents = InputProvider::readStdin();
+        } catch (std::exception &) {
+            llvm::errs() << options.input << ": " << strerror(errno) << "\n";
+            return 1;
         }
     }
 
-private:
-    Environment mEnv;
-    InterpreterVisitor mVisitor;
-};
+    struct Result {
+        std::string output;
+        std::string error;
+        double seconds;
+    };
+    std::vector<Result> results(files.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < files.size();) {
+            Result &result = results[i];
+            auto start = std::chrono::steady_clock::now();
+            OutputSink out(result.output);
+            auto buffer = llvm::MemoryBuffer::getFile(files[i]);
+            if (!buffer) {
+                result.error = buffer.getError().message();
+            } else {
+                try {
+                    std::unique_ptr<InputProvider> in = openInput(options, contents);
+                    interpret((*buffer)->getBuffer().str(), options, out, *in);
+                } catch (StackOverflow &e) {
+                    result.error = e.what();
+                } catch (std::exception &) {
+                    result.error = "interpreter error";
+                }
+            }
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    };
 
-class InterpreterClassAction : public ASTFrontendAction {
-public:
-    virtual std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(
-            clang::CompilerInstance &Compiler, llvm::StringRef InFile) {
-        return std::make_unique<InterpreterConsumer>(Compiler.getASTContext());
+    if (!jobs)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < jobs && i < files.size(); ++i)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread &thread : pool)
+        thread.join();
+
+    int failed = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        llvm::json::Object object{
+                {"file",    files[i]},
+                {"status",  results[i].error.empty() ? "ok" : "error"},
+                {"output",  results[i].output},
+                {"seconds", results[i].seconds},
+        };
+        if (!results[i].error.empty()) {
+            object["error"] = results[i].error;
+            ++failed;
+        }
+        llvm::outs() << llvm::json::Value(std::move(object)) << "\n";
     }
-};
+    llvm::outs().flush();
+    return failed ? 1 : 0;
+}
 
+/// 基准测试模式：依次运行每个程序，分别统计解析时间、执行时间和每秒执行的指令数
+/// 每个程序输出一行 JSON，程序自己的输出不打印
+/// 本地代码和结果缓存命中时执行的指令不计入 instructions，所以每行都带上执行层和缓存的设置，
+/// 不同设置下的结果不能直接比较
+static int runBench(const std::vector<std::string> &paths, const Options &options) {
+    /// 标准输入只能读一次，每个程序都从头读同一份内容
+    std::shared_ptr<const std::string> contents;
+    if (options.input == "-") {
+        try {
+            contents = InputProvider::readStdin();
+        } catch (std::exception &) {
+            llvm::errs() << options.input << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+    }
+    int failed = 0;
+    for (const std::string &file : collectFiles(paths)) {
+        llvm::json::Object object{
+                {"file", file},
+                {"tier", options.jitThreshold ? "jit" : "interpreter"},
+                {"jit_threshold", int64_t(options.jitThreshold)},
+                {"memo", int64_t(options.memo)},
+        };
+        auto buffer = llvm::MemoryBuffer::getFile(file);
+        if (!buffer) {
+            object["status"] = "error";
+            object["error"] = buffer.getError().message();
+            llvm::outs() << llvm::json::Value(std::move(object)) << "\n";
+            ++failed;
+            continue;
+        }
+        std::string output;
+        OutputSink out(output);
+        try {
+            auto start = std::chrono::steady_clock::now();
+            std::unique_ptr<ASTUnit> ast = ASTCache(options.cache ? ASTCache::defaultDir() : "").load(
+                    (*buffer)->getBuffer().str());
+            double parse = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (!ast)
+                throw std::exception();
+            std::unique_ptr<InputProvider> in = openInput(options, contents);
+            InterpreterConsumer consumer(ast->getASTContext(), out, *in, options);
+            consumer.HandleTranslationUnit(ast->getASTContext());
+            double exec = consumer.getExecSeconds();
+            object["status"] = "ok";
+            object["parse_seconds"] = parse;
+            object["exec_seconds"] = exec;
+            object["instructions"] = int64_t(consumer.getSteps());
+            object["instructions_per_second"] = exec > 0 ? consumer.getSteps() / exec : 0.0;
+        } catch (StackOverflow &e) {
+            object["status"] = "error";
+            object["error"] = e.what();
+            ++failed;
+        } catch (std::exception &) {
+            object["status"] = "error";
+            object["error"] = "interpreter error";
+            ++failed;
+        }
+        llvm::outs() << llvm::json::Value(std::move(object)) << "\n";
+        llvm::outs().flush();
+    }
+    return failed ? 1 : 0;
+}
+
+static void usage(const char *program) {
+    llvm::errs() << "usage: " << program << " [options] <source code>\n"
+                 << "       " << program << " [options] --batch|--bench <file or directory>...\n"
+                 << "options:\n"
+                 << "  --no-cache                 parse the source every time instead of using the AST cache\n"
+                 << "  --batch                    run every program on a worker pool, one JSON result per line\n"
+                 << "  --bench                    run every program once and report its speed as JSON\n"
+                 << "  --jobs=N                   worker threads for --batch (default: one per core)\n"
+                 << "  --no-jit                   only interpret, never compile to native code\n"
+                 << "  --jit=N                    compile a function after N calls (default: 1000)\n"
+                 << "  --input=FILE               read GET() values from FILE, - for stdin\n"
+                 << "  --output=DEST              PRINT to stderr (default), stdout or a file\n"
+                 << "  --max-depth=N              call depth limit (default: " << VM::kDefaultMaxDepth << ")\n"
+                 << "  --profile[=FILE]           time every function, write folded stacks to FILE\n"
+                 << "  --sample[=FILE]            sample hot source lines, write folded stacks to FILE\n"
+                 << "  --sample-hz=N              samples per second of CPU time (default: 1000)\n"
+                 << "  --memory-report[=FILE]     report memory use by allocation site\n"
+                 << "  --memo[=N]                 cache results of pure recursive functions (default: 65536 entries)\n"
+                 << "  --memo-stats               report result cache hit rate\n"
+                 << "  --trace[=N]                dump the last N executed instructions on a crash\n"
+                 << "  --checkpoint=FILE          save state to FILE on CHECKPOINT() or SIGUSR1\n"
+                 << "  --restore=FILE             resume from a checkpoint instead of running main\n"
+                 << "  --coverage=FILE            write lcov line and branch coverage to FILE\n"
+                 << "  --coverage-source=PATH     source path recorded in the coverage report\n"
+                 << "  --help                     show this message\n";
+}
 
 int main(int argc, char **argv) {
-    if (argc > 1) {
-        clang::tooling::runToolOnCode(std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction), argv[1]);
+    Options options;
+    bool batch = false;
+    bool bench = false;
+    /// 命令行上指定了 --jit= 或者 --no-jit
+    bool tier = false;
+    unsigned jobs = 0;
+    int i = 1;
+    for (; i < argc && !strncmp(argv[i], "--", 2); ++i) {
+        if (!strcmp(argv[i], "--no-cache"))
+            options.cache = false;
+        else if (!strcmp(argv[i], "--batch"))
+            batch = true;
+        else if (!strcmp(argv[i], "--bench"))
+            bench = true;
+        else if (!strncmp(argv[i], "--jobs=", 7))
+            jobs = atoi(argv[i] + 7);
+        else if (!strcmp(argv[i], "--no-jit")) {
+            options.jitThreshold = 0;
+            tier = true;
+        } else if (!strncmp(argv[i], "--jit=", 6)) {
+            options.jitThreshold = atoi(argv[i] + 6);
+            tier = true;
+        } else if (!strncmp(argv[i], "--input=", 8))
+            options.input = argv[i] + 8;
+        else if (!strncmp(argv[i], "--output=", 9))
+            options.output = argv[i] + 9;
+        else if (!strncmp(argv[i], "--max-depth=", 12))
+            options.maxDepth = std::max(1ll, atoll(argv[i] + 12));
+        else if (!strcmp(argv[i], "--profile"))
+            options.profile = true;
+        else if (!strncmp(argv[i], "--profile=", 10)) {
+            options.profile = true;
+            options.profileOutput = argv[i] + 10;
+        } else if (!strcmp(argv[i], "--sample")) {
+            options.sample = true;
+        } else if (!strncmp(argv[i], "--sample=", 9)) {
+            options.sample = true;
+            options.sampleOutput = argv[i] + 9;
+        } else if (!strncmp(argv[i], "--sample-hz=", 12)) {
+            options.sampleHz = atol(argv[i] + 12);
+        } else if (!strcmp(argv[i], "--memory-report")) {
+            options.memoryReport = true;
+        } else if (!strncmp(argv[i], "--memory-report=", 16)) {
+            options.memoryReport = true;
+            options.memoryReportOutput = argv[i] + 16;
+        } else if (!strcmp(argv[i], "--memo")) {
+            options.memo = 1 << 16;
+        } else if (!strncmp(argv[i], "--memo=", 7)) {
+            options.memo = strtoull(argv[i] + 7, NULL, 10);
+        } else if (!strcmp(argv[i], "--memo-stats")) {
+            options.memoStats = true;
+        } else if (!strcmp(argv[i], "--trace")) {
+            options.trace = 4096;
+        } else if (!strncmp(argv[i], "--trace=", 8)) {
+            options.trace = strtoull(argv[i] + 8, NULL, 10);
+        } else if (!strncmp(argv[i], "--checkpoint=", 13)) {
+            options.checkpoint = argv[i] + 13;
+        } else if (!strncmp(argv[i], "--restore=", 10)) {
+            options.restore = argv[i] + 10;
+        } else if (!strncmp(argv[i], "--coverage=", 11)) {
+            options.coverage = argv[i] + 11;
+        } else if (!strncmp(argv[i], "--coverage-source=", 18)) {
+            options.coverageSource = argv[i] + 18;
+        } else if (!strcmp(argv[i], "--help")) {
+            usage(argv[0]);
+            return 0;
+        } else {
+            /// 拼错的选项不能悄悄地按默认值运行
+            llvm::errs() << argv[0] << ": unknown option " << argv[i] << "\n";
+            usage(argv[0]);
+            return 1;
+        }
+    }
+#ifdef AST_INTERPRETER_TRACE
+    if (options.trace > Trace::kMaxCapacity) {
+        llvm::errs() << "--trace: at most " << Trace::kMaxCapacity << " instructions\n";
+        options.trace = Trace::kMaxCapacity;
+    }
+#else
+    if (options.trace)
+        llvm::errs() << "--trace: not compiled in, rebuild with -DENABLE_TRACE=ON\n";
+#endif
+    /// 批量运行时所有程序共用同一个文件名，报告和检查点会互相覆盖，恢复时也分不清是哪个程序的状态
+    auto single = [&](const char *flag, std::string &path) {
+        if ((bench || batch) && !path.empty()) {
+            llvm::errs() << flag << ": only supported for a single program\n";
+            path.clear();
+        }
+    };
+    if (options.memo > MemoCache::kMaxCapacity) {
+        llvm::errs() << "--memo: at most " << MemoCache::kMaxCapacity << " entries\n";
+        options.memo = MemoCache::kMaxCapacity;
+    }
+    single("--coverage", options.coverage);
+    single("--checkpoint", options.checkpoint);
+    single("--restore", options.restore);
+    single("--profile=FILE", options.profileOutput);
+    single("--memory-report=FILE", options.memoryReportOutput);
+    /// SIGPROF 的处理函数和定时器是整个进程共用的，多个程序同时采样会把样本记到别人头上
+    if ((bench || batch) && options.sample) {
+        llvm::errs() << "--sample: only supported for a single program\n";
+        options.sample = false;
+        options.sampleOutput.clear();
+    }
+    /// 基准测试默认只解释执行，测的是解释器本身，和以前的结果可以比较；要测 JIT 时显式指定 --jit=N
+    if (bench && !tier)
+        options.jitThreshold = 0;
+    if (bench)
+        return runBench(std::vector<std::string>(argv + i, argv + argc), options);
+    if (batch)
+        return runBatch(std::vector<std::string>(argv + i, argv + argc), jobs, options);
+    std::unique_ptr<OutputSink> out;
+    if (options.output == "stderr") {
+        out.reset(new OutputSink(STDERR_FILENO));
+    } else if (options.output == "stdout") {
+        out.reset(new OutputSink(STDOUT_FILENO));
+    } else {
+        try {
+            out.reset(new OutputSink(OutputSink::openFile(options.output), true));
+        } catch (std::exception &) {
+            llvm::errs() << options.output << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+    }
+    std::unique_ptr<InputProvider> in;
+    try {
+        in = openInput(options);
+    } catch (std::exception &) {
+        llvm::errs() << options.input << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    if (i < argc) {
+        try {
+            interpret(argv[i], options, *out, *in);
+        } catch (StackOverflow &e) {
+            out->flush();
+            llvm::errs() << e.what() << "\n";
+            return 1;
+        } catch (CheckpointError &e) {
+            out->flush();
+            llvm::errs() << e.what() << "\n";
+            return 1;
+        }
     } else {
         std::string filename("/home/black/ast-interpreter/test/test");
         std::string index;
         std::cout << "请输入测试文件编号：" << std::endl;
         std::cin >> index;
         filename.append(index).append(".c");
+        if (options.coverageSource.empty())
+            options.coverageSource = filename;
         std::ifstream t(filename);
         std::string buffer((std::istreambuf_iterator<char>(t)),
                            std::istreambuf_iterator<char>());
-        clang::tooling::runToolOnCode(std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction), buffer);
+        interpret(buffer, options, *out, *in);
     }
 }
@@ -0,0 +1,199 @@
+//==--- Bytecode.h - Register bytecode for lowered function bodies --------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace clang {
+    class FunctionDecl;
+}
+
+/// 每条指令统一为 op a b c 的格式，a 一般是目的寄存器
+/// 中间结果全部放在寄存器里，不再经过 StackFrame 的 mExprs 字典
+enum Opcode : unsigned char {
+    OP_CONST,       /// a = b
+    OP_MOV,         /// a = reg[b]
+    OP_LOADGLOBAL,  /// a = 第 b 个全局变量
+    OP_STOREGLOBAL, /// 第 a 个全局变量 = reg[b]
+    OP_ALLOCA,      /// a = 本帧数组区里偏移 c 处的 b 字节的数组，清零
+
+    OP_ADD,         /// a = reg[b] op reg[c]
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_REM,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_NEG,         /// a = -reg[b]
+    OP_ADDI,        /// a = reg[b] + c，c 是立即数
+    OP_SEXT8,       /// a = reg[b] 的低 8 位按有符号数扩展，转换成 char
+    OP_SEXT16,      /// a = reg[b] 的低 16 位按有符号数扩展，转换成 short
+
+    OP_PTRADD,      /// a = 指针 reg[b] 向后偏移 reg[c] 个元素，元素大小是 scale
+    OP_PTRSUB,      /// a = 指针 reg[b] 向前偏移 reg[c] 个元素
+    OP_LOAD8,       /// a = *reg[b]，按有符号数扩展到 64 位
+    OP_LOAD16,
+    OP_LOAD32,
+    OP_LOAD64,
+    OP_STORE8,      /// *reg[a] = reg[b]，只写低位的字节
+    OP_STORE16,
+    OP_STORE32,
+    OP_STORE64,
+
+    OP_JMP,         /// 跳转到 a
+    OP_JZ,          /// reg[a] 为 0 时跳转到 b
+    OP_JNZ,         /// reg[a] 不为 0 时跳转到 b
+
+    /// 比较并跳转，循环和 if 的条件不再经过一个存放比较结果的寄存器
+    OP_JLT,         /// reg[a] op reg[b] 时跳转到 c
+    OP_JLE,
+    OP_JGT,
+    OP_JGE,
+    OP_JEQ,
+    OP_JNE,
+    OP_JLTI,        /// reg[a] op b 时跳转到 c，b 是立即数
+    OP_JLEI,
+    OP_JGTI,
+    OP_JGEI,
+    OP_JEQI,
+    OP_JNEI,
+
+    OP_CALL,        /// a = callees[b](reg[c], reg[c + 1], ...)，第一次执行后改写成 OP_CALLQ
+    OP_CALLQ,       /// a = targets[b](reg[c], reg[c + 1], ...)
+    OP_RET,         /// 返回 reg[a]
+    OP_RETVOID,
+
+    /// 内部函数
+    OP_INPUT,       /// a = GET()
+    OP_PRINT,       /// PRINT(reg[a])
+    OP_MALLOC,      /// a = MALLOC(reg[b])，c 是分配点
+    OP_FREE,        /// FREE(reg[a])
+    OP_CHECKPOINT,  /// CHECKPOINT()，把整个执行状态保存到检查点文件
+
+    OP_COUNT,       /// 覆盖率计数器 counts[a] 加一
+};
+
+/// 调试输出用的指令名，顺序和 Opcode 一致
+inline const char *opcodeName(Opcode op) {
+    static const char *const names[] = {
+            "CONST", "MOV", "LOADGLOBAL", "STOREGLOBAL", "ALLOCA",
+            "ADD", "SUB", "MUL", "DIV", "REM", "LT", "LE", "GT", "GE", "EQ", "NE", "NEG", "ADDI", "SEXT8", "SEXT16",
+            "PTRADD", "PTRSUB", "LOAD8", "LOAD16", "LOAD32", "LOAD64", "STORE8", "STORE16", "STORE32", "STORE64",
+            "JMP", "JZ", "JNZ",
+            "JLT", "JLE", "JGT", "JGE", "JEQ", "JNE", "JLTI", "JLEI", "JGTI", "JGEI", "JEQI", "JNEI",
+            "CALL", "CALLQ", "RET", "RETVOID",
+            "INPUT", "PRINT", "MALLOC", "FREE", "CHECKPOINT",
+            "COUNT",
+    };
+    return op < sizeof(names) / sizeof(names[0]) ? names[op] : "?";
+}
+
+/// 指令是否把结果写到寄存器 a
+inline bool writesA(Opcode op) {
+    switch (op) {
+        case OP_STOREGLOBAL:
+        case OP_STORE8:
+        case OP_STORE16:
+        case OP_STORE32:
+        case OP_STORE64:
+        case OP_JMP:
+        case OP_JZ:
+        case OP_JNZ:
+        case OP_JLT:
+        case OP_JLE:
+        case OP_JGT:
+        case OP_JGE:
+        case OP_JEQ:
+        case OP_JNE:
+        case OP_JLTI:
+        case OP_JLEI:
+        case OP_JGTI:
+        case OP_JGEI:
+        case OP_JEQI:
+        case OP_JNEI:
+        case OP_RET:
+        case OP_RETVOID:
+        case OP_PRINT:
+        case OP_FREE:
+        case OP_CHECKPOINT:
+        case OP_COUNT:
+            return false;
+        default:
+            return true;
+    }
+}
+
+struct Instr {
+    Opcode op;
+    /// 指针运算的元素字节数，放在 op 后面的空隙里，指令仍然是 16 字节
+    uint16_t scale;
+    int a;
+    int b;
+    int c;
+};
+
+/// 覆盖率计数器对应的源码位置
+enum ProbeKind {
+    PROBE_FUNCTION, /// 函数入口
+    PROBE_LINE,     /// 一条语句
+    PROBE_BRANCH    /// 条件的一个分支：if 的 then/else，循环的进入循环体/离开循环
+};
+
+struct Probe {
+    ProbeKind kind;
+    int line;
+    /// 同一个条件的分支共用第一个分支的计数器编号，arm 是分支的序号
+    int branch;
+    int arm;
+};
+
+/// 一个函数降级之后的结果
+/// 寄存器的前 numSlots 个是变量槽位，参数在最前面，其余的是临时寄存器
+class Function {
+public:
+    clang::FunctionDecl *decl;
+    std::string name;
+    std::vector<Instr> code;
+    /// 每条指令对应的源码行号，0 表示不知道
+    std::vector<int> lines;
+    /// 覆盖率模式下的计数器，下标就是 OP_COUNT 的 a，降级完成后大小不再变化
+    std::vector<Probe> probes;
+    std::vector<uint64_t> counts;
+    /// OP_CALL 引用的被调函数
+    std::vector<clang::FunctionDecl *> callees;
+    /// 第一次调用时解析出来的被调函数，下标和 callees 一一对应
+    std::vector<Function *> targets;
+    int numParams;
+    /// 参数和局部变量的个数
+    int numSlots;
+    /// 需要的寄存器个数
+    int numRegs;
+    /// 局部数组区的字节数，调用时在数组栈上分配，返回时释放
+    int64_t arrayBytes;
+    /// 被调用的次数，达到阈值后交给 JIT 编译
+    unsigned calls;
+    /// JIT 编译出来的入口，参数从 frame[0] 开始依次存放，为空表示还在解释执行
+    int64_t (*native)(int64_t *frame);
+    /// PurityAnalysis 已经分析过
+    bool analyzed;
+    /// 递归的纯函数，结果按实参缓存在 MemoCache 里
+    bool memoize;
+
+    explicit Function(clang::FunctionDecl *d) : decl(d), name(), code(), lines(), probes(), counts(), callees(), targets(), numParams(0), numSlots(0),
+                                                numRegs(0), arrayBytes(0), calls(0), native(NULL), analyzed(false), memoize(false) {
+    }
+
+    /// 第 index 个被调函数，第一次用到时才由 resolve 降级，解释器、JIT 和纯函数分析共用结果
+    Function *target(int index, const std::function<Function *(clang::FunctionDecl *)> &resolve) {
+        if (!targets[index])
+            targets[index] = resolve(callees[index]);
+        return targets[index];
+    }
+};
@@ -0,0 +1,154 @@
+//==--- Checkpoint.h - Binary snapshot files of interpreter state ---------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <string>
+
+/// 保存或者恢复检查点失败，what() 是给用户看的错误信息
+class CheckpointError : public std::exception {
+    std::string mMessage;
+
+public:
+    explicit CheckpointError(const std::string &message) : mMessage("checkpoint: " + message) {
+    }
+
+    const char *what() const noexcept override {
+        return mMessage.c_str();
+    }
+};
+
+/// 检查点文件以魔数、版本和源码的哈希开头，恢复时源码必须和保存时完全一样，
+/// 这样重新降级得到的字节码才和保存下来的 pc 对得上
+/// 之后的数据按本机字节序原样写入，只能在同一种机器上恢复
+static const uint64_t kCheckpointMagic = 0x54504b4349545341ull;
+static const uint32_t kCheckpointVersion = 4;
+
+/// 先写到临时文件，完成后再改名，写到一半被打断时不会破坏上一个检查点
+class CheckpointWriter {
+    std::string mPath;
+    std::string mTemp;
+    FILE *mFile;
+
+public:
+    CheckpointWriter(const std::string &path, uint64_t program) : mPath(path), mTemp(path + ".tmp"),
+                                                                  mFile(fopen(mTemp.c_str(), "wb")) {
+        if (!mFile)
+            throw CheckpointError("cannot write " + mTemp);
+        /// 构造函数抛出异常时不会调用析构函数，要自己关闭文件
+        try {
+            write(kCheckpointMagic);
+            write(kCheckpointVersion);
+            write(program);
+        } catch (...) {
+            fclose(mFile);
+            remove(mTemp.c_str());
+            throw;
+        }
+    }
+
+    ~CheckpointWriter() {
+        if (mFile) {
+            fclose(mFile);
+            remove(mTemp.c_str());
+        }
+    }
+
+    CheckpointWriter(const CheckpointWriter &) = delete;
+
+    CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+    void write(const void *data, size_t size) {
+        if (fwrite(data, 1, size, mFile) != size)
+            throw CheckpointError("cannot write " + mTemp);
+    }
+
+    template<typename T>
+    void write(const T &val) {
+        write(&val, sizeof(T));
+    }
+
+    void writeString(const std::string &str) {
+        write<uint64_t>(str.size());
+        write(str.data(), str.size());
+    }
+
+    void commit() {
+        FILE *file = mFile;
+        mFile = NULL;
+        if (fclose(file) || rename(mTemp.c_str(), mPath.c_str())) {
+            remove(mTemp.c_str());
+            throw CheckpointError("cannot write " + mPath);
+        }
+    }
+};
+
+class CheckpointReader {
+    std::string mPath;
+    FILE *mFile;
+    uint64_t mSize;
+
+public:
+    /// program 和文件里记录的哈希不一致时拒绝恢复
+    CheckpointReader(const std::string &path, uint64_t program) : mPath(path), mFile(fopen(path.c_str(), "rb")),
+                                                                  mSize(0) {
+        if (!mFile)
+            throw CheckpointError("cannot read " + path);
+        /// 构造函数抛出异常时不会调用析构函数，要自己关闭文件
+        try {
+            long size;
+            if (fseek(mFile, 0, SEEK_END) || (size = ftell(mFile)) < 0 || fseek(mFile, 0, SEEK_SET))
+                throw CheckpointError("cannot read " + path);
+            mSize = size;
+            if (read<uint64_t>() != kCheckpointMagic || read<uint32_t>() != kCheckpointVersion)
+                throw CheckpointError(path + " is not a checkpoint file");
+            if (read<uint64_t>() != program)
+                throw CheckpointError(path + " was saved from a different program");
+        } catch (...) {
+            fclose(mFile);
+            throw;
+        }
+    }
+
+    ~CheckpointReader() {
+        fclose(mFile);
+    }
+
+    CheckpointReader(const CheckpointReader &) = delete;
+
+    CheckpointReader &operator=(const CheckpointReader &) = delete;
+
+    void read(void *data, size_t size) {
+        if (fread(data, 1, size, mFile) != size)
+            throw CheckpointError(mPath + " is truncated");
+    }
+
+    template<typename T>
+    T read() {
+        T val;
+        read(&val, sizeof(T));
+        return val;
+    }
+
+    /// 读出元素的个数，文件剩下的部分放不下这么多个 size 字节的元素时说明文件已经损坏，不能按它分配内存
+    uint64_t readCount(size_t size) {
+        uint64_t count = read<uint64_t>();
+        long pos = ftell(mFile);
+        check(pos >= 0 && count <= (mSize - uint64_t(pos)) / size);
+        return count;
+    }
+
+    std::string readString() {
+        std::string str(readCount(1), '\0');
+        read(&str[0], str.size());
+        return str;
+    }
+
+    /// 检查读出来的数据是否合理，损坏的文件不能让解释器越界访问
+    void check(bool ok) {
+        if (!ok)
+            throw CheckpointError(mPath + " is corrupt");
+    }
+};
@@ -0,0 +1,721 @@
+//==--- Compiler.h - Lower function bodies to register bytecode -----------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "clang/AST/StmtVisitor.h"
+
+#include "Bytecode.h"
+#include "ConstantFolder.h"
+#include "Environment.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+using namespace clang;
+
+/// 降级之前先把函数里所有的局部变量收集出来，依次编号
+class SlotCollector : public RecursiveASTVisitor<SlotCollector> {
+    std::map<Decl *, int> &mSlots;
+public:
+    explicit SlotCollector(std::map<Decl *, int> &slots) : mSlots(slots) {
+    }
+
+    bool VisitVarDecl(VarDecl *vardecl) {
+        if (vardecl->hasLocalStorage() && mSlots.find(vardecl) == mSlots.end()) {
+            int slot = mSlots.size();
+            mSlots[vardecl] = slot;
+        }
+        return true;
+    }
+};
+
+/// 语句降级之后的完成方式，都是负数，和表达式返回的寄存器区分开
+/// 非正常完成的语句后面的代码执行不到，不再生成
+enum Completion {
+    COMPLETION_NORMAL = -1,
+    COMPLETION_RETURN = -2,
+    COMPLETION_BREAK = -3,
+    COMPLETION_CONTINUE = -4
+};
+
+/// 把 FunctionDecl 的函数体降级成线性的寄存器字节码，每个函数只降级一次
+/// 表达式的 Visit 返回存放结果的寄存器，语句返回 Completion
+class Compiler : public StmtVisitor<Compiler, int> {
+    Environment *mEnv;
+    ConstantFolder mFolder;
+    std::map<FunctionDecl *, std::unique_ptr<Function>> mFunctions;
+
+    /// 正在降级的函数
+    Function *mFn;
+    /// 参数和局部变量到寄存器槽位的映射，只在降级时使用
+    std::map<Decl *, int> mSlots;
+    std::map<FunctionDecl *, int> mCalleeIndex;
+    /// 下一个空闲的临时寄存器，每条语句结束后回收
+    int mNextReg;
+    /// 正在降级的语句所在的行，记录到每条指令上
+    int mLine;
+    /// 当前作用域里的局部数组在数组区里用到的字节数，离开作用域时回收，
+    /// 兄弟作用域的数组共用同一段空间，循环体每次迭代也用同一块
+    int64_t mArrayTop;
+    /// 是否插入覆盖率计数器
+    bool mCoverage;
+
+    /// 正在降级的循环里 break/continue 产生的跳转，循环结束时回填
+    struct Loop {
+        std::vector<int> breaks;
+        std::vector<int> continues;
+    };
+    std::vector<Loop> mLoops;
+
+    /// 左值可能是局部变量的槽位、全局变量的槽位，或者是存放在寄存器里的地址
+    enum LValueKind {
+        LV_SLOT,
+        LV_GLOBAL,
+        LV_MEM
+    };
+
+    /// LV_MEM 的 size 是访存的字节数
+    struct LValue {
+        LValueKind kind;
+        int index;
+        int size;
+    };
+
+    int emit(Opcode op, int a = 0, int b = 0, int c = 0) {
+        mFn->code.push_back(Instr{op, 0, a, b, c});
+        mFn->lines.push_back(mLine);
+        return mFn->code.size() - 1;
+    }
+
+    /// 指针运算按指向的元素大小缩放偏移
+    /// 元素超过 scale 放得下的 65535 字节时（比如很长的二维数组的一行），把大小拆成 hi * 65535 + lo，
+    /// 用几条 PTRADD 算出偏移：它们都是 64 位运算，OP_MUL 和 OP_ADD 会截断成 int
+    int emitPointer(Opcode op, int a, int b, int c, QualType element) {
+        int64_t scale = mFolder.sizeOf(element);
+        if (scale <= 0 || scale / UINT16_MAX > UINT16_MAX)
+            throw std::exception();
+        if (scale <= UINT16_MAX) {
+            int pc = emit(op, a, b, c);
+            mFn->code[pc].scale = scale;
+            return pc;
+        }
+        int mark = mNextReg;
+        int hi = newReg();
+        emit(OP_CONST, hi, 0);
+        mFn->code[emit(OP_PTRADD, hi, hi, c)].scale = scale / UINT16_MAX;
+        int partial = newReg();
+        mFn->code[emit(op, partial, b, hi)].scale = UINT16_MAX;
+        int pc = emit(op, a, partial, c);
+        mFn->code[pc].scale = scale % UINT16_MAX;
+        mNextReg = mark;
+        return pc;
+    }
+
+    static Opcode loadOp(int64_t size) {
+        switch (size) {
+            case 1:
+                return OP_LOAD8;
+            case 2:
+                return OP_LOAD16;
+            case 4:
+                return OP_LOAD32;
+            case 8:
+                return OP_LOAD64;
+            default:
+                throw std::exception();
+        }
+    }
+
+    static Opcode storeOp(int64_t size) {
+        switch (size) {
+            case 1:
+                return OP_STORE8;
+            case 2:
+                return OP_STORE16;
+            case 4:
+                return OP_STORE32;
+            case 8:
+                return OP_STORE64;
+            default:
+                throw std::exception();
+        }
+    }
+
+    int here() {
+        return mFn->code.size();
+    }
+
+    /// 覆盖率模式下插入一个计数器，返回它的编号，否则什么都不生成，返回 -1
+    /// branch 是同一个条件第一个分支的计数器编号，第一个分支自己传 -1
+    int probe(ProbeKind kind, int line, int branch = -1, int arm = 0) {
+        if (!mCoverage)
+            return -1;
+        int index = mFn->probes.size();
+        mFn->probes.push_back(Probe{kind, line, branch < 0 ? index : branch, arm});
+        emit(OP_COUNT, index);
+        return index;
+    }
+
+    /// 回填跳转指令的目标
+    void patch(int jump, int target) {
+        Instr &instr = mFn->code[jump];
+        if (instr.op == OP_JMP)
+            instr.a = target;
+        else if (instr.op == OP_JZ || instr.op == OP_JNZ)
+            instr.b = target;
+        else
+            instr.c = target;
+    }
+
+    static bool isImmediate(int64_t val) {
+        return val >= INT32_MIN && val <= INT32_MAX;
+    }
+
+    /// 条件的值等于 sense 时跳转，返回需要回填的跳转指令
+    /// 比较运算直接生成比较并跳转的指令，右边是常量时用立即数的版本
+    int branch(Expr *cond, bool sense) {
+        int mark = mNextReg;
+        int jump;
+        BinaryOperator *bop = dyn_cast<BinaryOperator>(cond->IgnoreParens());
+        if (bop && bop->isComparisonOp()) {
+            BinaryOperatorKind kind = bop->getOpcode();
+            if (!sense)
+                kind = BinaryOperator::negateComparisonOp(kind);
+            static const std::map<BinaryOperatorKind, std::pair<Opcode, Opcode>> ops = {
+                    {BO_LT, {OP_JLT, OP_JLTI}},
+                    {BO_LE, {OP_JLE, OP_JLEI}},
+                    {BO_GT, {OP_JGT, OP_JGTI}},
+                    {BO_GE, {OP_JGE, OP_JGEI}},
+                    {BO_EQ, {OP_JEQ, OP_JEQI}},
+                    {BO_NE, {OP_JNE, OP_JNEI}},
+            };
+            const std::pair<Opcode, Opcode> &op = ops.at(kind);
+            int val1 = Visit(bop->getLHS());
+            int64_t imm;
+            if (mFolder.fold(bop->getRHS(), imm) && isImmediate(imm))
+                jump = emit(op.second, val1, imm);
+            else
+                jump = emit(op.first, val1, Visit(bop->getRHS()));
+        } else {
+            jump = emit(sense ? OP_JNZ : OP_JZ, Visit(cond));
+        }
+        mNextReg = mark;
+        return jump;
+    }
+
+    int constant(int64_t val) {
+        int reg = newReg();
+        emit(OP_CONST, reg, val);
+        return reg;
+    }
+
+    int newReg() {
+        int reg = mNextReg++;
+        if (mNextReg > mFn->numRegs)
+            mFn->numRegs = mNextReg;
+        return reg;
+    }
+
+    int calleeIndex(FunctionDecl *callee) {
+        auto it = mCalleeIndex.find(callee);
+        if (it != mCalleeIndex.end())
+            return it->second;
+        mFn->callees.push_back(callee);
+        mFn->targets.push_back(NULL);
+        return mCalleeIndex[callee] = mFn->callees.size() - 1;
+    }
+
+    /// 语句之间不共享临时寄存器
+    /// 复合语句里的子语句结束后恢复外层语句的行号，循环末尾的判断仍然算在循环语句上
+    /// 覆盖率计数器放在每条语句的开头，复合语句和空语句没有自己的计数器
+    int stmt(Stmt *s) {
+        int mark = mNextReg;
+        int line = mLine;
+        mLine = mEnv->getLine(s->getBeginLoc());
+        if (!isa<CompoundStmt>(s) && !isa<NullStmt>(s))
+            probe(PROBE_LINE, mLine);
+        int completion = Visit(s);
+        mLine = line;
+        mNextReg = mark;
+        return completion < 0 ? completion : COMPLETION_NORMAL;
+    }
+
+    /// 循环体降级完之后回填 break 和 continue
+    void endLoop(int continueTarget, int breakTarget) {
+        Loop &loop = mLoops.back();
+        for (int jump : loop.continues)
+            patch(jump, continueTarget);
+        for (int jump : loop.breaks)
+            patch(jump, breakTarget);
+        mLoops.pop_back();
+    }
+
+    LValue lvalue(Expr *expr) {
+        expr = expr->IgnoreParens();
+        if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+            Decl *decl = declref->getDecl();
+            auto it = mSlots.find(decl);
+            if (it != mSlots.end())
+                return LValue{LV_SLOT, it->second, 0};
+            int global = mEnv->getGlobalSlot(decl);
+            if (global < 0)
+                throw std::exception();
+            return LValue{LV_GLOBAL, global, 0};
+        }
+        if (UnaryOperator *oper = dyn_cast<UnaryOperator>(expr)) {
+            if (oper->getOpcode() == UO_Deref)
+                return LValue{LV_MEM, Visit(oper->getSubExpr()), int(mFolder.sizeOf(oper->getType()))};
+        }
+        if (ArraySubscriptExpr *array = dyn_cast<ArraySubscriptExpr>(expr)) {
+            int base = Visit(array->getBase());
+            int index = Visit(array->getIdx());
+            int addr = newReg();
+            emitPointer(OP_PTRADD, addr, base, index, array->getType());
+            return LValue{LV_MEM, addr, int(mFolder.sizeOf(array->getType()))};
+        }
+        throw std::exception();
+    }
+
+    /// 局部变量直接就是寄存器，不需要任何指令
+    int load(const LValue &lv) {
+        if (lv.kind == LV_SLOT)
+            return lv.index;
+        int reg = newReg();
+        if (lv.kind == LV_GLOBAL)
+            emit(OP_LOADGLOBAL, reg, lv.index);
+        else
+            emit(loadOp(lv.size), reg, lv.index);
+        return reg;
+    }
+
+    /// 返回保存了赋值结果的寄存器
+    int store(const LValue &lv, int val) {
+        switch (lv.kind) {
+            case LV_SLOT:
+                if (val == lv.index)
+                    return val;
+                /// 右边刚算出来的临时寄存器直接改写成目标槽位，省掉一次 MOV
+                if (val >= mFn->numSlots && !mFn->code.empty() && writesA(mFn->code.back().op) &&
+                    mFn->code.back().a == val) {
+                    mFn->code.back().a = lv.index;
+                } else {
+                    emit(OP_MOV, lv.index, val);
+                }
+                return lv.index;
+            case LV_GLOBAL:
+                emit(OP_STOREGLOBAL, lv.index, val);
+                return val;
+            default:
+                emit(storeOp(lv.size), lv.index, val);
+                return val;
+        }
+    }
+
+    Function *compile(FunctionDecl *decl) {
+        Function *fn = new Function(decl);
+        fn->name = decl->getNameAsString();
+        mFn = fn;
+        mSlots.clear();
+        mCalleeIndex.clear();
+        mLoops.clear();
+        mArrayTop = 0;
+        mLine = mEnv->getLine(decl->getBody()->getEndLoc());
+        /// 参数占据最前面的槽位，调用时实参直接拷贝进去
+        for (unsigned i = 0; i < decl->getNumParams(); ++i)
+            mSlots[decl->getParamDecl(i)] = i;
+        SlotCollector(mSlots).TraverseStmt(decl->getBody());
+        fn->numParams = decl->getNumParams();
+        fn->numSlots = fn->numRegs = mSlots.size();
+        mNextReg = fn->numSlots;
+        probe(PROBE_FUNCTION, mEnv->getLine(decl->getLocation()));
+        if (stmt(decl->getBody()) != COMPLETION_RETURN)
+            emit(OP_RETVOID);
+        fn->counts.assign(fn->probes.size(), 0);
+        return fn;
+    }
+
+public:
+    explicit Compiler(Environment *env) : mEnv(env), mFolder(), mFunctions(), mFn(NULL), mSlots(), mCalleeIndex(),
+                                          mNextReg(0), mLine(0), mArrayTop(0), mCoverage(false),
+                                          mLoops() {
+    }
+
+    /// 之后降级的函数都带上覆盖率计数器，要在第一次 getFunction 之前设置
+    void setCoverage(bool coverage) {
+        mCoverage = coverage;
+    }
+
+    /// Environment::init 之后分析整个程序，找出可以传播的常量
+    void analyze(TranslationUnitDecl *unit) {
+        mFolder.analyze(unit);
+    }
+
+    /// 第一次调用时降级，之后直接返回缓存的字节码
+    Function *getFunction(FunctionDecl *decl) {
+        if (decl->isDefined())
+            decl = decl->getDefinition();
+        std::unique_ptr<Function> &fn = mFunctions[decl];
+        if (!fn)
+            fn.reset(compile(decl));
+        return fn.get();
+    }
+
+    int VisitStmt(Stmt *s) {
+        throw std::exception();
+    }
+
+    int VisitNullStmt(NullStmt *s) {
+        return COMPLETION_NORMAL;
+    }
+
+    int VisitCompoundStmt(CompoundStmt *s) {
+        int64_t arrays = mArrayTop;
+        int completion = COMPLETION_NORMAL;
+        for (auto *SubStmt: s->body()) {
+            completion = stmt(SubStmt);
+            if (completion != COMPLETION_NORMAL)
+                break;
+        }
+        mArrayTop = arrays;
+        return completion;
+    }
+
+    int VisitDeclStmt(DeclStmt *declstmt) {
+        for (DeclStmt::decl_iterator it = declstmt->decl_begin(), ie = declstmt->decl_end();
+             it != ie; ++it) {
+            VarDecl *vardecl = dyn_cast<VarDecl>(*it);
+            /// 常量的每次使用都已经折叠掉了，不需要再给它赋值
+            if (!vardecl || mFolder.isConstant(vardecl))
+                continue;
+            QualType type = vardecl->getType();
+            if (type->isArrayType()) {
+                assert(isa<ConstantArrayType>(type.getTypePtr()));
+                int64_t size = mFolder.sizeOf(type);
+                emit(OP_ALLOCA, mSlots[vardecl], size, mArrayTop);
+                mArrayTop += (size + Memory::kAlign - 1) & ~(Memory::kAlign - 1);
+                mFn->arrayBytes = std::max(mFn->arrayBytes, mArrayTop);
+            } else if (type->isIntegerType() || type->isPointerType()) {
+                if (vardecl->hasInit())
+                    store(LValue{LV_SLOT, mSlots[vardecl], 0}, Visit(vardecl->getInit()));
+                else
+                    emit(OP_CONST, mSlots[vardecl], 0);
+            } else {
+                llvm::errs() << type.getTypePtr();
+                throw std::exception();
+            }
+        }
+        return COMPLETION_NORMAL;
+    }
+
+    /// 两个分支都非正常完成时 if 语句才算非正常完成
+    int VisitIfStmt(IfStmt *s) {
+        int64_t val;
+        if (mFolder.fold(s->getCond(), val)) {
+            Stmt *taken = val ? s->getThen() : s->getElse();
+            return taken ? stmt(taken) : COMPLETION_NORMAL;
+        }
+        int jump = branch(s->getCond(), false);
+        int arm = probe(PROBE_BRANCH, mLine);
+        int thenCompletion = stmt(s->getThen());
+        // 需要手动处理没有 Else 分支的情况
+        if (Stmt *elseStmt = s->getElse()) {
+            int skip = thenCompletion == COMPLETION_NORMAL ? emit(OP_JMP) : -1;
+            patch(jump, here());
+            probe(PROBE_BRANCH, mLine, arm, 1);
+            int elseCompletion = stmt(elseStmt);
+            if (skip >= 0)
+                patch(skip, here());
+            if (thenCompletion == COMPLETION_RETURN && elseCompletion == COMPLETION_RETURN)
+                return COMPLETION_RETURN;
+        } else if (mCoverage) {
+            /// 条件不成立的次数也要单独计数，then 分支跳过这个计数器
+            int skip = thenCompletion == COMPLETION_NORMAL ? emit(OP_JMP) : -1;
+            patch(jump, here());
+            probe(PROBE_BRANCH, mLine, arm, 1);
+            if (skip >= 0)
+                patch(skip, here());
+        } else {
+            patch(jump, here());
+        }
+        return COMPLETION_NORMAL;
+    }
+
+    /// 条件恒为真的循环不生成条件判断，恒为假的循环整个不生成
+    /// 循环按 do-while 的形状生成：入口判断一次条件，之后每次迭代只在末尾执行一条比较并跳转
+    /// 有条件的循环记两个分支：进入循环体和离开循环，break 也算离开循环
+    int VisitWhileStmt(WhileStmt *s) {
+        int64_t val;
+        bool folded = mFolder.fold(s->getCond(), val);
+        if (folded && !val)
+            return COMPLETION_NORMAL;
+        int exit = folded ? -1 : branch(s->getCond(), false);
+        int top = here();
+        int arm = folded ? -1 : probe(PROBE_BRANCH, mLine);
+        mLoops.push_back(Loop());
+        int completion = stmt(s->getBody());
+        int next = here();
+        if (completion == COMPLETION_NORMAL || !mLoops.back().continues.empty()) {
+            if (folded)
+                emit(OP_JMP, top);
+            else
+                patch(branch(s->getCond(), true), top);
+        }
+        if (exit >= 0)
+            patch(exit, here());
+        endLoop(next, here());
+        if (arm >= 0)
+            probe(PROBE_BRANCH, mLine, arm, 1);
+        return COMPLETION_NORMAL;
+    }
+
+    int VisitForStmt(ForStmt *s) {
+        if (s->getInit())
+            stmt(s->getInit());
+        Expr *cond = s->getCond();
+        int64_t val;
+        if (cond && mFolder.fold(cond, val)) {
+            if (!val)
+                return COMPLETION_NORMAL;
+            cond = NULL;
+        }
+        int exit = cond ? branch(cond, false) : -1;
+        int top = here();
+        int arm = cond ? probe(PROBE_BRANCH, mLine) : -1;
+        mLoops.push_back(Loop());
+        int completion = s->getBody() ? stmt(s->getBody()) : COMPLETION_NORMAL;
+        int next = here();
+        if (completion == COMPLETION_NORMAL || !mLoops.back().continues.empty()) {
+            if (s->getInc())
+                stmt(s->getInc());
+            if (cond)
+                patch(branch(cond, true), top);
+            else
+                emit(OP_JMP, top);
+        }
+        if (exit >= 0)
+            patch(exit, here());
+        endLoop(next, here());
+        if (arm >= 0)
+            probe(PROBE_BRANCH, mLine, arm, 1);
+        return COMPLETION_NORMAL;
+    }
+
+    int VisitBreakStmt(BreakStmt *s) {
+        if (mLoops.empty())
+            throw std::exception();
+        mLoops.back().breaks.push_back(emit(OP_JMP));
+        return COMPLETION_BREAK;
+    }
+
+    int VisitContinueStmt(ContinueStmt *s) {
+        if (mLoops.empty())
+            throw std::exception();
+        mLoops.back().continues.push_back(emit(OP_JMP));
+        return COMPLETION_CONTINUE;
+    }
+
+    int VisitReturnStmt(ReturnStmt *s) {
+        if (Expr *value = s->getRetValue())
+            emit(OP_RET, Visit(value));
+        else
+            emit(OP_RETVOID);
+        return COMPLETION_RETURN;
+    }
+
+    int VisitIntegerLiteral(IntegerLiteral *integer) {
+        int reg = newReg();
+        emit(OP_CONST, reg, integer->getValue().getSExtValue());
+        return reg;
+    }
+
+    int VisitCharacterLiteral(CharacterLiteral *character) {
+        int reg = newReg();
+        emit(OP_CONST, reg, character->getValue());
+        return reg;
+    }
+
+    int VisitUnaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr *expr) {
+        if (expr->getKind() != UETT_SizeOf)
+            throw std::exception();
+        return constant(mFolder.sizeOf(expr->getTypeOfArgument()));
+    }
+
+    int VisitParenExpr(ParenExpr *expr) {
+        return Visit(expr->getSubExpr());
+    }
+
+    /// 数组变量的值就是它在堆区的地址
+    int VisitDeclRefExpr(DeclRefExpr *expr) {
+        return load(lvalue(expr));
+    }
+
+    int VisitArraySubscriptExpr(ArraySubscriptExpr *expr) {
+        return load(lvalue(expr));
+    }
+
+    int VisitCastExpr(CastExpr *expr) {
+        int64_t val;
+        if (mFolder.fold(expr, val))
+            return constant(val);
+        switch (expr->getCastKind()) {
+            case CK_LValueToRValue:
+                return load(lvalue(expr->getSubExpr()));
+            /// 寄存器里的 int 已经按 32 位回绕，只有转换成 char 或 short 时才需要截断
+            case CK_IntegralCast: {
+                int val = Visit(expr->getSubExpr());
+                int64_t size = mFolder.sizeOf(expr->getType());
+                if (size >= 4 || size >= mFolder.sizeOf(expr->getSubExpr()->getType()))
+                    return val;
+                int reg = newReg();
+                emit(size == 1 ? OP_SEXT8 : OP_SEXT16, reg, val);
+                return reg;
+            }
+            /// 数组变量的值就是数组的地址，多维数组里的一行本身就在内存里，地址就是它的值
+            case CK_ArrayToPointerDecay: {
+                LValue lv = lvalue(expr->getSubExpr());
+                return lv.kind == LV_MEM ? lv.index : load(lv);
+            }
+            default:
+                return Visit(expr->getSubExpr());
+        }
+    }
+
+    int VisitUnaryOperator(UnaryOperator *oper) {
+        int64_t val;
+        if (mFolder.fold(oper, val))
+            return constant(val);
+        switch (oper->getOpcode()) {
+            case UO_Minus: {
+                int sub = Visit(oper->getSubExpr());
+                int reg = newReg();
+                emit(OP_NEG, reg, sub);
+                return reg;
+            }
+            case UO_Plus:
+                return Visit(oper->getSubExpr());
+            case UO_Deref:
+                return load(lvalue(oper));
+            default:
+                throw std::exception();
+        }
+    }
+
+    int VisitBinaryOperator(BinaryOperator *bop) {
+        Expr *left = bop->getLHS();
+        Expr *right = bop->getRHS();
+
+        if (bop->getOpcode() == BO_Assign) {
+            LValue lv = lvalue(left);
+            return store(lv, Visit(right));
+        }
+
+        int64_t val;
+        if (mFolder.fold(bop, val))
+            return constant(val);
+
+        /// 整数加减一个常量，比如循环变量的 i = i + 1，生成一条带立即数的加法
+        if ((bop->getOpcode() == BO_Add || bop->getOpcode() == BO_Sub) && !left->getType()->isPointerType() &&
+            !right->getType()->isPointerType()) {
+            int64_t imm;
+            if (mFolder.fold(right, imm) && isImmediate(bop->getOpcode() == BO_Add ? imm : -imm)) {
+                int reg = Visit(left);
+                int sum = newReg();
+                emit(OP_ADDI, sum, reg, bop->getOpcode() == BO_Add ? imm : -imm);
+                return sum;
+            }
+            if (bop->getOpcode() == BO_Add && mFolder.fold(left, imm) && isImmediate(imm)) {
+                int reg = Visit(right);
+                int sum = newReg();
+                emit(OP_ADDI, sum, reg, imm);
+                return sum;
+            }
+        }
+
+        int val1 = Visit(left);
+        int val2 = Visit(right);
+        int reg = newReg();
+        switch (bop->getOpcode()) {
+            case BO_Add:
+                if (left->getType()->isPointerType())
+                    emitPointer(OP_PTRADD, reg, val1, val2, left->getType()->getPointeeType());
+                else if (right->getType()->isPointerType())
+                    emitPointer(OP_PTRADD, reg, val2, val1, right->getType()->getPointeeType());
+                else
+                    emit(OP_ADD, reg, val1, val2);
+                break;
+            case BO_Sub:
+                if (left->getType()->isPointerType() && !right->getType()->isPointerType())
+                    emitPointer(OP_PTRSUB, reg, val1, val2, left->getType()->getPointeeType());
+                else if (left->getType()->isPointerType() || right->getType()->isPointerType())
+                    throw std::exception();
+                else
+                    emit(OP_SUB, reg, val1, val2);
+                break;
+            case BO_Mul:
+                emit(OP_MUL, reg, val1, val2);
+                break;
+            case BO_Div:
+                emit(OP_DIV, reg, val1, val2);
+                break;
+            case BO_Rem:
+                emit(OP_REM, reg, val1, val2);
+                break;
+            case BO_GE:
+                emit(OP_GE, reg, val1, val2);
+                break;
+            case BO_GT:
+                emit(OP_GT, reg, val1, val2);
+                break;
+            case BO_LE:
+                emit(OP_LE, reg, val1, val2);
+                break;
+            case BO_LT:
+                emit(OP_LT, reg, val1, val2);
+                break;
+            case BO_EQ:
+                emit(OP_EQ, reg, val1, val2);
+                break;
+            case BO_NE:
+                emit(OP_NE, reg, val1, val2);
+                break;
+            default:
+                throw std::exception();
+        }
+        return reg;
+    }
+
+    int VisitCallExpr(CallExpr *call) {
+        FunctionDecl *callee = call->getDirectCallee();
+        if (callee->isDefined())
+            callee = callee->getDefinition();
+        int reg = newReg();
+        if (callee == mEnv->getInput()) {
+            emit(OP_INPUT, reg);
+        } else if (callee == mEnv->getOutput()) {
+            emit(OP_PRINT, Visit(call->getArg(0)));
+        } else if (callee == mEnv->getMalloc()) {
+            /// 和 C 一样按字节分配
+            emit(OP_MALLOC, reg, Visit(call->getArg(0)), mEnv->addSite("MALLOC", call->getBeginLoc()));
+        } else if (callee == mEnv->getFree()) {
+            emit(OP_FREE, Visit(call->getArg(0)));
+        } else if (callee == mEnv->getCheckpoint()) {
+            emit(OP_CHECKPOINT);
+        } else {
+            /// 实参放在连续的寄存器里
+            int base = mNextReg;
+            mNextReg += call->getNumArgs();
+            if (mNextReg > mFn->numRegs)
+                mFn->numRegs = mNextReg;
+            for (unsigned i = 0; i < call->getNumArgs(); i++) {
+                int mark = mNextReg;
+                int val = Visit(call->getArg(i));
+                if (val != int(base + i))
+                    emit(OP_MOV, base + i, val);
+                mNextReg = mark;
+            }
+            emit(OP_CALL, reg, calleeIndex(callee), base);
+        }
+        return reg;
+    }
+};
@@ -0,0 +1,205 @@
+//==--- ConstantFolder.h - Constant folding and propagation before lowering ===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "clang/AST/RecursiveASTVisitor.h"
+
+#include <map>
+#include <set>
+
+using namespace clang;
+
+/// 收集整个翻译单元里所有被赋值或者取地址的变量
+class AssignmentCollector : public RecursiveASTVisitor<AssignmentCollector> {
+    std::set<Decl *> &mAssigned;
+
+    void assigned(Expr *expr) {
+        if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr->IgnoreParenImpCasts()))
+            mAssigned.insert(declref->getDecl());
+    }
+
+public:
+    explicit AssignmentCollector(std::set<Decl *> &assigned) : mAssigned(assigned) {
+    }
+
+    bool VisitBinaryOperator(BinaryOperator *bop) {
+        if (bop->isAssignmentOp())
+            assigned(bop->getLHS());
+        return true;
+    }
+
+    bool VisitUnaryOperator(UnaryOperator *oper) {
+        if (oper->isIncrementDecrementOp() || oper->getOpcode() == UO_AddrOf)
+            assigned(oper->getSubExpr());
+        return true;
+    }
+};
+
+/// 在 Environment::init 之后分析整个程序：
+/// 初始值是常量并且从来没有被赋值过的整型变量就是常量，
+/// 由字面量、sizeof、常量变量和它们的运算组成的表达式在降级时直接折叠成一个常量
+/// 运算的语义和虚拟机保持一致，int 按 32 位回绕，除以 0 的表达式不折叠
+class ConstantFolder {
+    ASTContext *mContext;
+    std::set<Decl *> mAssigned;
+    /// 已经分析过的变量，false 表示不是常量
+    std::map<Decl *, bool> mKnown;
+    std::map<Decl *, int64_t> mValues;
+
+    static int64_t i32(int64_t val) {
+        return int32_t(uint32_t(val));
+    }
+
+    /// 转换成 char 或 short 时只保留低位，和 OP_SEXT8、OP_SEXT16 一致
+    int64_t narrow(QualType type, int64_t val) {
+        switch (sizeOf(type)) {
+            case 1:
+                return int8_t(val);
+            case 2:
+                return int16_t(val);
+            default:
+                return val;
+        }
+    }
+
+    bool constant(VarDecl *var, int64_t &val) {
+        auto it = mKnown.find(var);
+        if (it == mKnown.end()) {
+            /// 先标记为不是常量，防止 int a = a + 1 这样的初始值无限递归
+            mKnown[var] = false;
+            int64_t init = 0;
+            bool known = var->getType()->isIntegerType() && !mAssigned.count(var) && !isa<ParmVarDecl>(var) &&
+                         (var->hasInit() ? fold(var->getInit(), init) : var->hasGlobalStorage());
+            if (known)
+                mValues[var] = init;
+            it = mKnown.find(var);
+            it->second = known;
+        }
+        if (!it->second)
+            return false;
+        val = mValues[var];
+        return true;
+    }
+
+public:
+    ConstantFolder() : mContext(NULL), mAssigned(), mKnown(), mValues() {
+    }
+
+    void analyze(TranslationUnitDecl *unit) {
+        mContext = &unit->getASTContext();
+        AssignmentCollector(mAssigned).TraverseDecl(unit);
+    }
+
+    /// sizeof 的结果和目标平台一致：char 1 字节，int 4 字节，指针 8 字节
+    int64_t sizeOf(QualType type) {
+        return mContext->getTypeSizeInChars(type).getQuantity();
+    }
+
+    bool isConstant(VarDecl *var) {
+        int64_t val;
+        return constant(var, val);
+    }
+
+    bool fold(Expr *expr, int64_t &val) {
+        if (!expr->getType()->isIntegerType())
+            return false;
+        expr = expr->IgnoreParens();
+        if (IntegerLiteral *integer = dyn_cast<IntegerLiteral>(expr)) {
+            val = integer->getValue().getSExtValue();
+            return true;
+        }
+        if (CharacterLiteral *character = dyn_cast<CharacterLiteral>(expr)) {
+            val = character->getValue();
+            return true;
+        }
+        if (UnaryExprOrTypeTraitExpr *ueot = dyn_cast<UnaryExprOrTypeTraitExpr>(expr)) {
+            if (ueot->getKind() != UETT_SizeOf)
+                return false;
+            val = sizeOf(ueot->getTypeOfArgument());
+            return true;
+        }
+        if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+            VarDecl *var = dyn_cast<VarDecl>(declref->getDecl());
+            return var && constant(var, val);
+        }
+        if (CastExpr *cast = dyn_cast<CastExpr>(expr)) {
+            switch (cast->getCastKind()) {
+                case CK_LValueToRValue:
+                case CK_NoOp:
+                    return fold(cast->getSubExpr(), val);
+                case CK_IntegralCast:
+                    if (!fold(cast->getSubExpr(), val))
+                        return false;
+                    val = narrow(cast->getType(), val);
+                    return true;
+                case CK_IntegralToBoolean:
+                    if (!fold(cast->getSubExpr(), val))
+                        return false;
+                    val = val != 0;
+                    return true;
+                default:
+                    return false;
+            }
+        }
+        if (UnaryOperator *oper = dyn_cast<UnaryOperator>(expr)) {
+            if (!fold(oper->getSubExpr(), val))
+                return false;
+            switch (oper->getOpcode()) {
+                case UO_Minus:
+                    val = i32(-val);
+                    return true;
+                case UO_Plus:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+        if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr)) {
+            int64_t val1, val2;
+            if (bop->isAssignmentOp() || !fold(bop->getLHS(), val1) || !fold(bop->getRHS(), val2))
+                return false;
+            switch (bop->getOpcode()) {
+                case BO_Add:
+                    val = i32(val1 + val2);
+                    return true;
+                case BO_Sub:
+                    val = i32(val1 - val2);
+                    return true;
+                case BO_Mul:
+                    val = i32(val1 * val2);
+                    return true;
+                case BO_Div:
+                    if (!val2)
+                        return false;
+                    val = val1 / val2;
+                    return true;
+                case BO_Rem:
+                    if (!val2)
+                        return false;
+                    val = val1 % val2;
+                    return true;
+                case BO_GE:
+                    val = val1 >= val2;
+                    return true;
+                case BO_GT:
+                    val = val1 > val2;
+                    return true;
+                case BO_LE:
+                    val = val1 <= val2;
+                    return true;
+                case BO_LT:
+                    val = val1 < val2;
+                    return true;
+                case BO_EQ:
+                    val = val1 == val2;
+                    return true;
+                case BO_NE:
+                    val = val1 != val2;
+                    return true;
+                default:
+                    return false;
+            }
+        }
+        return false;
+    }
+};
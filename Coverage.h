@@ -0,0 +1,115 @@
+//==--- Coverage.h - Source line execution counts in lcov format ----------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "Bytecode.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+/// 把各个函数的覆盖率计数器汇总成 lcov 的 tracefile，可以交给 genhtml 或者 lcov --summary
+/// 计数器由 Compiler 插在语句、函数入口和分支开头，执行时只是对平坦数组里的一项加一，
+/// 这里才按行号合并：一行有多条语句时取最大的计数，和 gcov 一样
+class Coverage {
+    struct Entry {
+        int line;
+        Function *fn;
+        uint64_t calls;
+    };
+
+    struct Arm {
+        int line;
+        int block;
+        int arm;
+        uint64_t count;
+    };
+
+    std::vector<Function *> mFunctions;
+
+public:
+    Coverage() : mFunctions() {
+    }
+
+    /// 没有执行过的函数也要加进来，否则报告里看不到它们
+    void add(Function *fn) {
+        mFunctions.push_back(fn);
+    }
+
+    /// source 是 SF 记录里的源文件路径
+    void writeLcov(llvm::raw_ostream &out, const std::string &source) {
+        std::vector<Entry> functions;
+        std::map<int, uint64_t> lines;
+        std::vector<Arm> arms;
+        /// 每个条件所有分支的计数之和，为 0 时说明条件从来没有执行，lcov 里记成 "-"
+        std::vector<uint64_t> totals;
+        for (Function *fn : mFunctions) {
+            /// 分支的 block 编号在整个文件里唯一
+            std::map<int, int> blocks;
+            for (size_t i = 0; i < fn->probes.size(); ++i) {
+                const Probe &probe = fn->probes[i];
+                uint64_t count = fn->counts[i];
+                switch (probe.kind) {
+                    case PROBE_FUNCTION:
+                        functions.push_back(Entry{probe.line, fn, count});
+                        // fall through
+                    case PROBE_LINE: {
+                        uint64_t &line = lines[probe.line];
+                        line = std::max(line, count);
+                        break;
+                    }
+                    case PROBE_BRANCH: {
+                        auto it = blocks.insert(std::make_pair(probe.branch, int(totals.size()))).first;
+                        if (size_t(it->second) == totals.size())
+                            totals.push_back(0);
+                        totals[it->second] += count;
+                        arms.push_back(Arm{probe.line, it->second, probe.arm, count});
+                        break;
+                    }
+                }
+            }
+        }
+        std::stable_sort(functions.begin(), functions.end(), [](const Entry &a, const Entry &b) {
+            return a.line < b.line;
+        });
+        std::stable_sort(arms.begin(), arms.end(), [](const Arm &a, const Arm &b) {
+            return a.line < b.line;
+        });
+
+        out << "TN:\n";
+        out << "SF:" << source << "\n";
+        int hit = 0;
+        for (const Entry &entry : functions)
+            out << "FN:" << entry.line << "," << entry.fn->name << "\n";
+        for (const Entry &entry : functions) {
+            out << "FNDA:" << entry.calls << "," << entry.fn->name << "\n";
+            hit += entry.calls != 0;
+        }
+        out << "FNF:" << functions.size() << "\n";
+        out << "FNH:" << hit << "\n";
+
+        hit = 0;
+        for (const Arm &arm : arms) {
+            out << "BRDA:" << arm.line << "," << arm.block << "," << arm.arm << ",";
+            if (totals[arm.block])
+                out << arm.count << "\n";
+            else
+                out << "-\n";
+            hit += arm.count != 0;
+        }
+        out << "BRF:" << arms.size() << "\n";
+        out << "BRH:" << hit << "\n";
+
+        hit = 0;
+        for (auto &it : lines) {
+            out << "DA:" << it.first << "," << it.second << "\n";
+            hit += it.second != 0;
+        }
+        out << "LF:" << lines.size() << "\n";
+        out << "LH:" << hit << "\n";
+        out << "end_of_record\n";
+    }
+};
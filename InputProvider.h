@@ -0,0 +1,179 @@
+//==--- InputProvider.h - Source of the values returned by GET ------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// GET 读到的整数从哪里来
+/// 默认是交互模式，每次打印提示再用 scanf 读一个数；
+/// 指定了输入文件时把整个文件映射进内存（"-" 表示一次读完标准输入），不打印提示，直接在缓冲区上解析；
+/// 读进来的标准输入可以给多个 InputProvider 共用，各自从头读起；
+/// 嵌入使用时可以直接给一组整数
+/// 输入用完以后 GET 返回 0，和 scanf 失败时一样
+class InputProvider {
+    enum Kind {
+        INPUT_INTERACTIVE,
+        INPUT_BUFFER,
+        INPUT_VALUES
+    };
+
+    Kind mKind;
+    const char *mBegin;
+    const char *mPos;
+    const char *mEnd;
+    /// 映射的文件，不为空时析构时解除映射
+    void *mMapped;
+    size_t mMappedSize;
+    /// 从标准输入读进来的内容，只读，可能和别的 InputProvider 共用
+    std::shared_ptr<const std::string> mContents;
+    std::vector<int64_t> mValues;
+    size_t mNext;
+
+    static bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    int parse() {
+        while (mPos < mEnd && !isDigit(*mPos) && !(*mPos == '-' && mPos + 1 < mEnd && isDigit(mPos[1])))
+            ++mPos;
+        if (mPos == mEnd)
+            return 0;
+        bool negative = *mPos == '-';
+        if (negative)
+            ++mPos;
+        uint64_t val = 0;
+        while (mPos < mEnd && isDigit(*mPos))
+            val = val * 10 + (*mPos++ - '0');
+        return int32_t(uint32_t(negative ? 0 - val : val));
+    }
+
+    void share(std::shared_ptr<const std::string> contents) {
+        mContents = std::move(contents);
+        mBegin = mPos = mContents->data();
+        mEnd = mPos + mContents->size();
+    }
+
+    void map(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::exception();
+        struct stat st;
+        if (fstat(fd, &st)) {
+            ::close(fd);
+            throw std::exception();
+        }
+        if (st.st_size) {
+            void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                throw std::exception();
+            }
+            madvise(addr, st.st_size, MADV_SEQUENTIAL);
+            mMapped = addr;
+            mMappedSize = st.st_size;
+            mBegin = mPos = static_cast<const char *>(addr);
+            mEnd = mPos + st.st_size;
+        }
+        ::close(fd);
+    }
+
+public:
+    InputProvider() : mKind(INPUT_INTERACTIVE), mBegin(NULL), mPos(NULL), mEnd(NULL), mMapped(NULL), mMappedSize(0), mContents(),
+                      mValues(), mNext(0) {
+    }
+
+    /// 从文件读取，"-" 表示标准输入，打不开时抛出异常
+    explicit InputProvider(const std::string &path)
+            : mKind(INPUT_BUFFER), mBegin(NULL), mPos(NULL), mEnd(NULL), mMapped(NULL), mMappedSize(0), mContents(), mValues(),
+              mNext(0) {
+        if (path == "-")
+            share(readStdin());
+        else
+            map(path);
+    }
+
+    /// 从已经读进来的内容读取
+    explicit InputProvider(std::shared_ptr<const std::string> contents)
+            : mKind(INPUT_BUFFER), mBegin(NULL), mPos(NULL), mEnd(NULL), mMapped(NULL), mMappedSize(0), mContents(), mValues(),
+              mNext(0) {
+        share(std::move(contents));
+    }
+
+    explicit InputProvider(const std::vector<int64_t> &values)
+            : mKind(INPUT_VALUES), mBegin(NULL), mPos(NULL), mEnd(NULL), mMapped(NULL), mMappedSize(0), mContents(),
+              mValues(values), mNext(0) {
+    }
+
+    ~InputProvider() {
+        if (mMapped)
+            munmap(mMapped, mMappedSize);
+    }
+
+    InputProvider(const InputProvider &) = delete;
+
+    InputProvider &operator=(const InputProvider &) = delete;
+
+    /// 一次读完标准输入，读取失败时抛出异常
+    /// 标准输入只能读一次，要给多个程序用时先读出来再分给各自的 InputProvider
+    static std::shared_ptr<const std::string> readStdin() {
+        std::string contents;
+        char chunk[64 << 10];
+        ssize_t n;
+        while ((n = ::read(STDIN_FILENO, chunk, sizeof(chunk))) != 0) {
+            if (n < 0)
+                throw std::exception();
+            contents.append(chunk, n);
+        }
+        return std::make_shared<const std::string>(std::move(contents));
+    }
+
+    /// 只有交互模式需要提示
+    bool interactive() {
+        return mKind == INPUT_INTERACTIVE;
+    }
+
+    /// 已经读过的输入，交互模式没法回到以前的位置，总是 0
+    uint64_t position() {
+        switch (mKind) {
+            case INPUT_BUFFER:
+                return mPos - mBegin;
+            case INPUT_VALUES:
+                return mNext;
+            default:
+                return 0;
+        }
+    }
+
+    /// 从检查点恢复时跳过已经读过的输入
+    void seek(uint64_t pos) {
+        if (mKind == INPUT_BUFFER)
+            mPos = mBegin + std::min<uint64_t>(pos, mEnd - mBegin);
+        else if (mKind == INPUT_VALUES)
+            mNext = std::min<uint64_t>(pos, mValues.size());
+    }
+
+    int next() {
+        switch (mKind) {
+            case INPUT_INTERACTIVE: {
+                int val = 0;
+                scanf("%d", &val);
+                return val;
+            }
+            case INPUT_BUFFER:
+                return parse();
+            default:
+                return mNext < mValues.size() ? int32_t(uint32_t(mValues[mNext++])) : 0;
+        }
+    }
+};
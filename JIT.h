@@ -0,0 +1,514 @@
+//==--- JIT.h - Native tier for hot bytecode functions via LLVM ORC --------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#ifdef AST_INTERPRETER_JIT
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/TargetSelect.h"
+
+#include "Bytecode.h"
+
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+/// 编译出来的代码通过这些回调使用解释器的内置函数，
+/// 线性内存和全局变量的地址在运行期间不会移动，直接作为常量嵌进代码里
+struct JITRuntime {
+    char *memory;
+    int64_t *globals;
+    void *context;
+    int64_t (*input)(void *context);
+    void (*output)(void *context, int64_t val);
+    int64_t (*allocHeap)(void *context, int64_t size, int64_t site);
+    void (*freeHeap)(void *context, int64_t ptr);
+    /// 在数组栈上分配 bytes 字节的局部数组区，返回它的地址，返回时把 *arrayTop 恢复成这个地址
+    int64_t (*pushArrays)(void *context, int64_t bytes);
+    int64_t *arrayTop;
+    /// 和解释器共用的调用深度，超过 maxDepth 时调用 overflow，它不会返回
+    int64_t *depth;
+    int64_t maxDepth;
+    void (*overflow)(void *context);
+    /// 宿主栈用到 stackLimit 以下时不再往下递归，把这次调用交给 interpret 解释执行
+    /// fn 是被调的 Function，args 指向依次存放的实参
+    char *stackLimit;
+    int64_t (*interpret)(void *context, int64_t fn, int64_t args);
+};
+
+/// 把字节码翻译成 LLVM IR，优化后交给 ORC LLJIT 生成本地代码
+/// 每个函数有两个符号：impl 按值接收参数，供编译出来的函数之间直接调用；
+/// entry 从解释器的寄存器栈上读参数，供虚拟机调用
+/// 一次编译热点函数和它还没有编译过的所有被调函数，本地代码不会再回到解释器
+class JIT {
+    std::function<Function *(clang::FunctionDecl *)> mResolve;
+    JITRuntime mRuntime;
+    std::unique_ptr<llvm::orc::LLJIT> mJIT;
+
+    typedef llvm::IRBuilder<> Builder;
+
+    static std::string symbol(const char *prefix, Function *fn) {
+        char name[64];
+        snprintf(name, sizeof(name), "%s_%p", prefix, static_cast<void *>(fn));
+        return name;
+    }
+
+    /// 收集 fn 和它直接或间接调用的、还没有本地代码的函数
+    void collect(Function *fn, std::vector<Function *> &closure, std::set<Function *> &seen) {
+        if (fn->native || !seen.insert(fn).second)
+            return;
+        closure.push_back(fn);
+        for (size_t i = 0; i < fn->callees.size(); ++i)
+            collect(fn->target(i, mResolve), closure, seen);
+    }
+
+    static llvm::Function *declare(llvm::Module &module, Function *fn) {
+        std::string name = symbol("impl", fn);
+        if (llvm::Function *f = module.getFunction(name))
+            return f;
+        llvm::Type *i64 = llvm::Type::getInt64Ty(module.getContext());
+        std::vector<llvm::Type *> params(fn->numParams, i64);
+        return llvm::Function::Create(llvm::FunctionType::get(i64, params, false), llvm::Function::ExternalLinkage,
+                                      name, &module);
+    }
+
+    /// 把宿主里的地址变成指定类型的指针常量
+    static llvm::Value *address(Builder &b, const void *addr, llvm::Type *type) {
+        return b.CreateIntToPtr(b.getInt64(reinterpret_cast<uint64_t>(addr)), llvm::PointerType::getUnqual(type));
+    }
+
+    /// 调用 JITRuntime 里的回调，第一个参数总是 context
+    llvm::Value *callRuntime(Builder &b, const void *callback, llvm::Type *result, std::vector<llvm::Value *> args) {
+        std::vector<llvm::Type *> params(1, llvm::PointerType::getUnqual(b.getInt8Ty()));
+        for (size_t i = 0; i < args.size(); ++i)
+            params.push_back(b.getInt64Ty());
+        llvm::FunctionType *type = llvm::FunctionType::get(result, params, false);
+        args.insert(args.begin(), address(b, mRuntime.context, b.getInt8Ty()));
+        return b.CreateCall(type, address(b, callback, type), args);
+    }
+
+    /// 和虚拟机一样，int 运算的结果按 32 位回绕
+    static llvm::Value *wrap(Builder &b, llvm::Value *val) {
+        return b.CreateSExt(b.CreateTrunc(val, b.getInt32Ty()), b.getInt64Ty());
+    }
+
+    /// 线性内存里 addr 处的 type 类型的指针
+    static llvm::Value *memory(Builder &b, char *base, llvm::Value *addr, llvm::Type *type) {
+        llvm::Value *ptr = b.CreateAdd(b.getInt64(reinterpret_cast<uint64_t>(base)), addr);
+        return b.CreateIntToPtr(ptr, llvm::PointerType::getUnqual(type));
+    }
+
+    /// 读出 addr 处 bits 位的整数，和虚拟机一样按有符号数扩展到 64 位；线性内存里的地址不一定对齐
+    static llvm::Value *load(Builder &b, char *base, llvm::Value *addr, unsigned bits) {
+        llvm::Type *type = b.getIntNTy(bits);
+        return b.CreateSExt(b.CreateAlignedLoad(type, memory(b, base, addr, type), llvm::MaybeAlign(1)),
+                            b.getInt64Ty());
+    }
+
+    /// 只写 val 的低 bits 位
+    static void store(Builder &b, char *base, llvm::Value *addr, llvm::Value *val, unsigned bits) {
+        llvm::Type *type = b.getIntNTy(bits);
+        b.CreateAlignedStore(b.CreateTrunc(val, type), memory(b, base, addr, type), llvm::MaybeAlign(1));
+    }
+
+    /// 每个寄存器是一个 alloca，由 mem2reg 提升成 SSA 值
+    void translate(llvm::Module &module, Function *fn) {
+        llvm::LLVMContext &context = module.getContext();
+        llvm::Function *f = declare(module, fn);
+        Builder b(llvm::BasicBlock::Create(context, "entry", f));
+        llvm::Type *i64 = b.getInt64Ty();
+
+        std::vector<llvm::Value *> regs(fn->numRegs);
+        for (int i = 0; i < fn->numRegs; ++i)
+            regs[i] = b.CreateAlloca(i64);
+        for (int i = 0; i < fn->numParams; ++i)
+            b.CreateStore(f->getArg(i), regs[i]);
+
+        /// 调用深度的上限和解释执行时一样
+        /// 本地代码的递归在宿主栈上，宿主栈快用完时这次调用交回虚拟机，
+        /// 解释执行的调用不占宿主栈，所以打开 JIT 不会让能运行的程序栈溢出
+        llvm::Value *spill = fn->numParams ? b.CreateAlloca(i64, b.getInt32(fn->numParams)) : NULL;
+        llvm::Value *depthPtr = address(b, mRuntime.depth, i64);
+        llvm::Value *depth = b.CreateLoad(i64, depthPtr);
+        llvm::Value *inner = b.CreateAdd(depth, b.getInt64(1));
+        llvm::BasicBlock *overflow = llvm::BasicBlock::Create(context, "overflow", f);
+        llvm::BasicBlock *stack = llvm::BasicBlock::Create(context, "stack", f);
+        llvm::BasicBlock *fallback = llvm::BasicBlock::Create(context, "fallback", f);
+        llvm::BasicBlock *body = llvm::BasicBlock::Create(context, "body", f);
+        b.CreateCondBr(b.CreateICmpSGT(inner, b.getInt64(mRuntime.maxDepth)), overflow, stack);
+        b.SetInsertPoint(overflow);
+        callRuntime(b, reinterpret_cast<void *>(mRuntime.overflow), b.getVoidTy(), {});
+        b.CreateUnreachable();
+        b.SetInsertPoint(stack);
+        llvm::Type *bytePtr = llvm::PointerType::getUnqual(b.getInt8Ty());
+        llvm::Value *frame = b.CreateCall(
+                llvm::Intrinsic::getDeclaration(&module, llvm::Intrinsic::frameaddress, {bytePtr}), {b.getInt32(0)});
+        b.CreateCondBr(b.CreateICmpULT(b.CreatePtrToInt(frame, i64),
+                                       b.getInt64(reinterpret_cast<uint64_t>(mRuntime.stackLimit))), fallback, body);
+        b.SetInsertPoint(fallback);
+        for (int i = 0; i < fn->numParams; ++i)
+            b.CreateStore(f->getArg(i), b.CreateGEP(i64, spill, b.getInt64(i)));
+        b.CreateRet(callRuntime(b, reinterpret_cast<void *>(mRuntime.interpret), i64,
+                                {b.getInt64(reinterpret_cast<uint64_t>(fn)),
+                                 spill ? b.CreatePtrToInt(spill, i64) : b.getInt64(0)}));
+        b.SetInsertPoint(body);
+        b.CreateStore(inner, depthPtr);
+        llvm::Value *arrays = NULL;
+        if (fn->arrayBytes)
+            arrays = callRuntime(b, reinterpret_cast<void *>(mRuntime.pushArrays), i64, {b.getInt64(fn->arrayBytes)});
+        auto ret = [&](llvm::Value *val) {
+            if (arrays)
+                b.CreateStore(arrays, address(b, mRuntime.arrayTop, i64));
+            b.CreateStore(depth, depthPtr);
+            b.CreateRet(val);
+        };
+
+        auto get = [&](int reg) {
+            return b.CreateLoad(i64, regs[reg]);
+        };
+        auto set = [&](int reg, llvm::Value *val) {
+            b.CreateStore(val, regs[reg]);
+        };
+
+        /// 跳转目标和跳转之后的指令是基本块的开头
+        const std::vector<Instr> &code = fn->code;
+        std::vector<llvm::BasicBlock *> blocks(code.size() + 1);
+        auto leader = [&](size_t index) {
+            if (!blocks[index])
+                blocks[index] = llvm::BasicBlock::Create(context, "", f);
+        };
+        leader(0);
+        for (size_t i = 0; i < code.size(); ++i) {
+            switch (code[i].op) {
+                case OP_JMP:
+                    leader(code[i].a);
+                    leader(i + 1);
+                    break;
+                case OP_JZ:
+                case OP_JNZ:
+                    leader(code[i].b);
+                    leader(i + 1);
+                    break;
+                case OP_JLT:
+                case OP_JLE:
+                case OP_JGT:
+                case OP_JGE:
+                case OP_JEQ:
+                case OP_JNE:
+                case OP_JLTI:
+                case OP_JLEI:
+                case OP_JGTI:
+                case OP_JGEI:
+                case OP_JEQI:
+                case OP_JNEI:
+                    leader(code[i].c);
+                    leader(i + 1);
+                    break;
+                case OP_RET:
+                case OP_RETVOID:
+                    leader(i + 1);
+                    break;
+                default:
+                    break;
+            }
+        }
+        b.CreateBr(blocks[0]);
+
+        for (size_t i = 0; i <= code.size(); ++i) {
+            if (blocks[i]) {
+                if (!b.GetInsertBlock()->getTerminator())
+                    b.CreateBr(blocks[i]);
+                b.SetInsertPoint(blocks[i]);
+            }
+            if (i == code.size()) {
+                if (!b.GetInsertBlock()->getTerminator())
+                    ret(b.getInt64(0));
+                break;
+            }
+            const Instr &in = code[i];
+            switch (in.op) {
+                case OP_CONST:
+                    set(in.a, b.getInt64(in.b));
+                    break;
+                case OP_MOV:
+                    set(in.a, get(in.b));
+                    break;
+                case OP_LOADGLOBAL:
+                    set(in.a, b.CreateLoad(i64, address(b, mRuntime.globals + in.b, i64)));
+                    break;
+                case OP_STOREGLOBAL:
+                    b.CreateStore(get(in.b), address(b, mRuntime.globals + in.a, i64));
+                    break;
+                case OP_ALLOCA: {
+                    llvm::Value *addr = b.CreateAdd(arrays, b.getInt64(in.c));
+                    b.CreateMemSet(memory(b, mRuntime.memory, addr, b.getInt8Ty()), b.getInt8(0), in.b,
+                                   llvm::MaybeAlign(1));
+                    set(in.a, addr);
+                    break;
+                }
+                case OP_ADD:
+                    set(in.a, wrap(b, b.CreateAdd(get(in.b), get(in.c))));
+                    break;
+                case OP_SUB:
+                    set(in.a, wrap(b, b.CreateSub(get(in.b), get(in.c))));
+                    break;
+                case OP_MUL:
+                    set(in.a, wrap(b, b.CreateMul(get(in.b), get(in.c))));
+                    break;
+                case OP_DIV:
+                    set(in.a, b.CreateSDiv(get(in.b), get(in.c)));
+                    break;
+                case OP_REM:
+                    set(in.a, b.CreateSRem(get(in.b), get(in.c)));
+                    break;
+                case OP_LT:
+                    set(in.a, b.CreateZExt(b.CreateICmpSLT(get(in.b), get(in.c)), i64));
+                    break;
+                case OP_LE:
+                    set(in.a, b.CreateZExt(b.CreateICmpSLE(get(in.b), get(in.c)), i64));
+                    break;
+                case OP_GT:
+                    set(in.a, b.CreateZExt(b.CreateICmpSGT(get(in.b), get(in.c)), i64));
+                    break;
+                case OP_GE:
+                    set(in.a, b.CreateZExt(b.CreateICmpSGE(get(in.b), get(in.c)), i64));
+                    break;
+                case OP_EQ:
+                    set(in.a, b.CreateZExt(b.CreateICmpEQ(get(in.b), get(in.c)), i64));
+                    break;
+                case OP_NE:
+                    set(in.a, b.CreateZExt(b.CreateICmpNE(get(in.b), get(in.c)), i64));
+                    break;
+                case OP_NEG:
+                    set(in.a, wrap(b, b.CreateNeg(get(in.b))));
+                    break;
+                case OP_ADDI:
+                    set(in.a, wrap(b, b.CreateAdd(get(in.b), b.getInt64(in.c))));
+                    break;
+                case OP_SEXT8:
+                    set(in.a, b.CreateSExt(b.CreateTrunc(get(in.b), b.getInt8Ty()), i64));
+                    break;
+                case OP_SEXT16:
+                    set(in.a, b.CreateSExt(b.CreateTrunc(get(in.b), b.getInt16Ty()), i64));
+                    break;
+                case OP_PTRADD:
+                    set(in.a, b.CreateAdd(get(in.b), b.CreateMul(get(in.c), b.getInt64(in.scale))));
+                    break;
+                case OP_PTRSUB:
+                    set(in.a, b.CreateSub(get(in.b), b.CreateMul(get(in.c), b.getInt64(in.scale))));
+                    break;
+                /// 宽度依次是 8、16、32、64 位
+                case OP_LOAD8:
+                case OP_LOAD16:
+                case OP_LOAD32:
+                case OP_LOAD64:
+                    set(in.a, load(b, mRuntime.memory, get(in.b), 8 << (in.op - OP_LOAD8)));
+                    break;
+                case OP_STORE8:
+                case OP_STORE16:
+                case OP_STORE32:
+                case OP_STORE64:
+                    store(b, mRuntime.memory, get(in.a), get(in.b), 8 << (in.op - OP_STORE8));
+                    break;
+                case OP_JMP:
+                    b.CreateBr(blocks[in.a]);
+                    break;
+                case OP_JZ:
+                    b.CreateCondBr(b.CreateICmpEQ(get(in.a), b.getInt64(0)), blocks[in.b], blocks[i + 1]);
+                    break;
+                case OP_JNZ:
+                    b.CreateCondBr(b.CreateICmpNE(get(in.a), b.getInt64(0)), blocks[in.b], blocks[i + 1]);
+                    break;
+                case OP_JLT:
+                    b.CreateCondBr(b.CreateICmpSLT(get(in.a), get(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_JLE:
+                    b.CreateCondBr(b.CreateICmpSLE(get(in.a), get(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_JGT:
+                    b.CreateCondBr(b.CreateICmpSGT(get(in.a), get(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_JGE:
+                    b.CreateCondBr(b.CreateICmpSGE(get(in.a), get(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_JEQ:
+                    b.CreateCondBr(b.CreateICmpEQ(get(in.a), get(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_JNE:
+                    b.CreateCondBr(b.CreateICmpNE(get(in.a), get(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_JLTI:
+                    b.CreateCondBr(b.CreateICmpSLT(get(in.a), b.getInt64(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_JLEI:
+                    b.CreateCondBr(b.CreateICmpSLE(get(in.a), b.getInt64(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_JGTI:
+                    b.CreateCondBr(b.CreateICmpSGT(get(in.a), b.getInt64(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_JGEI:
+                    b.CreateCondBr(b.CreateICmpSGE(get(in.a), b.getInt64(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_JEQI:
+                    b.CreateCondBr(b.CreateICmpEQ(get(in.a), b.getInt64(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_JNEI:
+                    b.CreateCondBr(b.CreateICmpNE(get(in.a), b.getInt64(in.b)), blocks[in.c], blocks[i + 1]);
+                    break;
+                case OP_CALL:
+                case OP_CALLQ: {
+                    Function *callee = fn->target(in.b, mResolve);
+                    std::vector<llvm::Value *> args;
+                    for (int k = 0; k < callee->numParams; ++k)
+                        args.push_back(get(in.c + k));
+                    set(in.a, b.CreateCall(declare(module, callee), args));
+                    break;
+                }
+                case OP_RET:
+                    ret(get(in.a));
+                    break;
+                case OP_RETVOID:
+                    ret(b.getInt64(0));
+                    break;
+                case OP_INPUT:
+                    set(in.a, callRuntime(b, reinterpret_cast<void *>(mRuntime.input), i64, {}));
+                    break;
+                case OP_PRINT:
+                    callRuntime(b, reinterpret_cast<void *>(mRuntime.output), b.getVoidTy(), {get(in.a)});
+                    break;
+                case OP_MALLOC:
+                    set(in.a, callRuntime(b, reinterpret_cast<void *>(mRuntime.allocHeap), i64,
+                                          {get(in.b), b.getInt64(in.c)}));
+                    break;
+                case OP_FREE:
+                    callRuntime(b, reinterpret_cast<void *>(mRuntime.freeHeap), b.getVoidTy(), {get(in.a)});
+                    break;
+                /// 计数器数组在降级完成后不再变化，地址可以直接写进代码
+                case OP_COUNT: {
+                    llvm::Value *counter = address(b, &fn->counts[in.a], i64);
+                    b.CreateStore(b.CreateAdd(b.CreateLoad(i64, counter), b.getInt64(1)), counter);
+                    break;
+                }
+                default:
+                    throw std::exception();
+            }
+        }
+
+        /// 虚拟机调用的入口
+        llvm::Function *entry = llvm::Function::Create(
+                llvm::FunctionType::get(i64, {llvm::PointerType::getUnqual(i64)}, false),
+                llvm::Function::ExternalLinkage, symbol("entry", fn), &module);
+        b.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", entry));
+        std::vector<llvm::Value *> args;
+        for (int i = 0; i < fn->numParams; ++i)
+            args.push_back(b.CreateLoad(i64, b.CreateGEP(i64, entry->getArg(0), b.getInt64(i))));
+        b.CreateRet(b.CreateCall(f, args));
+    }
+
+    static void optimize(llvm::Module &module) {
+        llvm::LoopAnalysisManager lam;
+        llvm::FunctionAnalysisManager fam;
+        llvm::CGSCCAnalysisManager cgam;
+        llvm::ModuleAnalysisManager mam;
+        llvm::PassBuilder builder;
+        builder.registerModuleAnalyses(mam);
+        builder.registerCGSCCAnalyses(cgam);
+        builder.registerFunctionAnalyses(fam);
+        builder.registerLoopAnalyses(lam);
+        builder.crossRegisterProxies(lam, fam, cgam, mam);
+#if LLVM_VERSION_MAJOR >= 14
+        llvm::ModulePassManager passes = builder.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2);
+#else
+        llvm::ModulePassManager passes = builder.buildPerModuleDefaultPipeline(llvm::PassBuilder::OptimizationLevel::O2);
+#endif
+        passes.run(module, mam);
+    }
+
+    bool start() {
+        static std::once_flag initialized;
+        std::call_once(initialized, []() {
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+        });
+        auto jit = llvm::orc::LLJITBuilder().create();
+        if (!jit) {
+            llvm::consumeError(jit.takeError());
+            return false;
+        }
+        mJIT = std::move(*jit);
+        return true;
+    }
+
+public:
+    /// resolve 把被调函数的声明降级成字节码
+    JIT(const JITRuntime &runtime, std::function<Function *(clang::FunctionDecl *)> resolve)
+            : mResolve(resolve), mRuntime(runtime), mJIT() {
+    }
+
+    /// 编译 fn 以及它调用的函数，成功后设置它们的 native 入口
+    bool compile(Function *fn) {
+        if (fn->native)
+            return true;
+        if (!mJIT && !start())
+            return false;
+
+        std::vector<Function *> closure;
+        std::set<Function *> seen;
+        collect(fn, closure, seen);
+        /// 检查点只能在解释执行时保存，本地代码的栈帧没法写进文件；
+        /// 缓存结果的函数也要留给虚拟机执行
+        for (Function *f : closure) {
+            if (f->memoize)
+                return false;
+            for (const Instr &in : f->code) {
+                if (in.op == OP_CHECKPOINT)
+                    return false;
+            }
+        }
+
+        std::unique_ptr<llvm::LLVMContext> context(new llvm::LLVMContext());
+        std::unique_ptr<llvm::Module> module(new llvm::Module(symbol("module", fn), *context));
+        module->setDataLayout(mJIT->getDataLayout());
+        module->setTargetTriple(mJIT->getTargetTriple().str());
+        for (Function *f : closure)
+            translate(*module, f);
+        if (llvm::verifyModule(*module))
+            return false;
+        optimize(*module);
+
+        if (llvm::Error err = mJIT->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+            llvm::consumeError(std::move(err));
+            return false;
+        }
+        std::vector<int64_t (*)(int64_t *)> entries;
+        for (Function *f : closure) {
+            auto sym = mJIT->lookup(symbol("entry", f));
+            if (!sym) {
+                llvm::consumeError(sym.takeError());
+                return false;
+            }
+#if LLVM_VERSION_MAJOR >= 15
+            entries.push_back(sym->toPtr<int64_t (*)(int64_t *)>());
+#else
+            entries.push_back(reinterpret_cast<int64_t (*)(int64_t *)>(sym->getAddress()));
+#endif
+        }
+        for (size_t i = 0; i < closure.size(); ++i)
+            closure[i]->native = entries[i];
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,183 @@
+//==--- Memo.h - Result cache for pure recursive functions ----------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Bytecode.h"
+
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <vector>
+
+/// 在降级后的字节码上判断函数能不能缓存结果
+/// 纯函数只读写自己的寄存器：不访问全局变量和内存，不做指针运算，不分配局部数组，
+/// 不调用 GET、PRINT、MALLOC、FREE 和 CHECKPOINT，调用的函数也都是纯的
+/// 只缓存会递归的纯函数，重叠子问题只出现在递归里，不递归的小函数查表反而比直接执行慢，
+/// 而且它们可以交给 JIT 编译
+class PurityAnalysis {
+public:
+    /// 参数更多的函数不缓存
+    static const int kMaxArgs = 4;
+
+private:
+    std::function<Function *(clang::FunctionDecl *)> mResolve;
+
+    /// 从 fn 出发能调用到的所有函数
+    void reach(Function *fn, std::set<Function *> &seen) {
+        for (size_t i = 0; i < fn->callees.size(); ++i) {
+            Function *callee = fn->target(i, mResolve);
+            if (seen.insert(callee).second)
+                reach(callee, seen);
+        }
+    }
+
+    static bool isPure(Function *fn) {
+        for (const Instr &in : fn->code) {
+            switch (in.op) {
+                case OP_LOADGLOBAL:
+                case OP_STOREGLOBAL:
+                case OP_ALLOCA:
+                case OP_PTRADD:
+                case OP_PTRSUB:
+                case OP_LOAD8:
+                case OP_LOAD16:
+                case OP_LOAD32:
+                case OP_LOAD64:
+                case OP_STORE8:
+                case OP_STORE16:
+                case OP_STORE32:
+                case OP_STORE64:
+                case OP_INPUT:
+                case OP_PRINT:
+                case OP_MALLOC:
+                case OP_FREE:
+                case OP_CHECKPOINT:
+                /// 命中缓存时函数体不执行，覆盖率会少算
+                case OP_COUNT:
+                    return false;
+                default:
+                    break;
+            }
+        }
+        return true;
+    }
+
+    /// 没有 OP_RET 的函数不返回值，缓存没有意义
+    static bool returnsValue(Function *fn) {
+        for (const Instr &in : fn->code) {
+            if (in.op == OP_RET)
+                return true;
+        }
+        return false;
+    }
+
+public:
+    /// resolve 把被调函数的声明降级成字节码
+    explicit PurityAnalysis(std::function<Function *(clang::FunctionDecl *)> resolve) : mResolve(resolve) {
+    }
+
+    /// 设置 fn->memoize，每个函数只分析一次
+    void analyze(Function *fn) {
+        if (fn->analyzed)
+            return;
+        fn->analyzed = true;
+        if (!fn->numParams || fn->numParams > kMaxArgs || !returnsValue(fn))
+            return;
+        std::set<Function *> reachable;
+        reach(fn, reachable);
+        if (!reachable.count(fn))
+            return;
+        for (Function *f : reachable) {
+            if (!isPure(f))
+                return;
+        }
+        fn->memoize = true;
+    }
+};
+
+/// 按 (函数, 实参) 缓存纯函数的返回值
+/// 直接映射的定长表，冲突时覆盖旧的结果，内存占用有上限，查找只需要一次哈希和一次比较
+/// 表在第一次写入时才分配，没有可缓存函数的程序不付出这块内存
+class MemoCache {
+    struct Entry {
+        Function *fn;
+        int64_t args[PurityAnalysis::kMaxArgs];
+        int64_t val;
+    };
+
+    std::vector<Entry> mEntries;
+    uint64_t mCapacity;
+    uint64_t mMask;
+    uint64_t mLookups;
+    uint64_t mHits;
+    uint64_t mStores;
+    /// 覆盖了另一个结果的次数
+    uint64_t mEvictions;
+
+    Entry &slot(Function *fn, const int64_t *args) {
+        uint64_t hash = reinterpret_cast<uintptr_t>(fn);
+        for (int i = 0; i < fn->numParams; ++i)
+            hash = (hash ^ uint64_t(args[i])) * 0x9e3779b97f4a7c15ull;
+        return mEntries[(hash ^ (hash >> 32)) & mMask];
+    }
+
+    static bool matches(const Entry &entry, Function *fn, const int64_t *args) {
+        if (entry.fn != fn)
+            return false;
+        for (int i = 0; i < fn->numParams; ++i) {
+            if (entry.args[i] != args[i])
+                return false;
+        }
+        return true;
+    }
+
+public:
+    /// 表项数的上限，再大的表既放不进内存，向上取整时也会溢出
+    static const uint64_t kMaxCapacity = uint64_t(1) << 24;
+
+    /// capacity 向上取整到 2 的幂，超过 kMaxCapacity 的按 kMaxCapacity 算
+    explicit MemoCache(uint64_t capacity) : mEntries(), mCapacity(1), mMask(0), mLookups(0), mHits(0), mStores(0),
+                                            mEvictions(0) {
+        if (capacity > kMaxCapacity)
+            capacity = kMaxCapacity;
+        while (mCapacity < capacity)
+            mCapacity <<= 1;
+        mMask = mCapacity - 1;
+    }
+
+    /// args 是调用时的实参，命中时把结果写到 val
+    bool lookup(Function *fn, const int64_t *args, int64_t &val) {
+        ++mLookups;
+        if (mEntries.empty())
+            return false;
+        Entry &entry = slot(fn, args);
+        if (!matches(entry, fn, args))
+            return false;
+        ++mHits;
+        val = entry.val;
+        return true;
+    }
+
+    void insert(Function *fn, const int64_t *args, int64_t val) {
+        if (mEntries.empty())
+            mEntries.resize(mCapacity, Entry());
+        Entry &entry = slot(fn, args);
+        if (entry.fn && !matches(entry, fn, args))
+            ++mEvictions;
+        entry.fn = fn;
+        for (int i = 0; i < fn->numParams; ++i)
+            entry.args[i] = args[i];
+        entry.val = val;
+        ++mStores;
+    }
+
+    void report(llvm::raw_ostream &out) {
+        out << "memo: " << mLookups << " lookups, " << mHits << " hits";
+        if (mLookups)
+            out << llvm::format(" (%.1f%%)", 100.0 * mHits / mLookups);
+        out << ", " << mStores << " stores, " << mEvictions << " evictions, " << mCapacity << " entries\n";
+    }
+};
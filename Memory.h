@@ -0,0 +1,202 @@
+//==--- Memory.h - Flat linear address space of the interpreted program ---===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <sys/mman.h>
+
+#include "Checkpoint.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <vector>
+
+/// 被解释程序的所有数组和堆内存都在这一段线性地址空间里
+/// 指针就是相对 base 的 64 位偏移，解引用只需要一次加法和一次访存
+/// 只预留虚拟地址，物理页由操作系统按需提供，所以 base 永远不会移动
+///
+/// malloc/free 按大小分级管理：每个块前面有 8 字节记录容量，
+/// 不超过 kMaxSmall 的块按 2 的幂分级放进侵入式空闲链表，链表指针就存在空闲块里，
+/// 更大的块按容量放进 mLarge，分配时取能放下的最小的块
+class Memory {
+    char *mBase;
+    /// 预留的地址空间大小
+    uint64_t mLimit;
+    /// 还没有分配出去的第一个地址
+    uint64_t mTop;
+
+    static const int kMinShift = 4;
+    static const int kClasses = 13;
+    static const uint64_t kMaxSmall = uint64_t(1) << (kMinShift + kClasses - 1);
+    static const uint64_t kHeader = 8;
+    /// 检查点里只保存不全为 0 的页
+    static const uint64_t kPage = 4096;
+
+    /// 每一级空闲链表的表头，0 表示空
+    uint64_t mFree[kClasses];
+    std::multimap<uint64_t, uint64_t> mLarge;
+
+    uint64_t &word(uint64_t addr) {
+        return *reinterpret_cast<uint64_t *>(mBase + addr);
+    }
+
+    /// 从 page 开始的这一页里已经用掉的字节数，最后一页可能不满
+    /// 不用 std::min：它按引用接收参数，会要求 kPage 在类外另有定义
+    uint64_t pageBytes(uint64_t page) {
+        return mTop - page < kPage ? mTop - page : kPage;
+    }
+
+    /// 从检查点恢复的块要对齐，块头和 size 字节的内容都在已经用掉的地址空间里
+    bool inBounds(uint64_t addr, uint64_t size) {
+        return addr >= kAlign + kHeader && addr % kAlign == 0 && addr <= mTop && size <= mTop - addr;
+    }
+
+    static int sizeClass(uint64_t size) {
+        int cls = 0;
+        while ((uint64_t(1) << (kMinShift + cls)) < size)
+            ++cls;
+        return cls;
+    }
+
+public:
+    static const uint64_t kAlign = 8;
+
+    explicit Memory(uint64_t limit = uint64_t(1) << 32) : mBase(NULL), mLimit(limit), mTop(kAlign), mFree(), mLarge() {
+        void *base = mmap(NULL, mLimit, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+            throw std::exception();
+        mBase = static_cast<char *>(base);
+    }
+
+    ~Memory() {
+        munmap(mBase, mLimit);
+    }
+
+    Memory(const Memory &) = delete;
+
+    Memory &operator=(const Memory &) = delete;
+
+    char *base() {
+        return mBase;
+    }
+
+    /// 已经用掉的地址空间，包括块头和空闲链表里的块
+    uint64_t used() {
+        return mTop;
+    }
+
+    /// 地址 0 保留给空指针，新分配的内存总是全 0
+    uint64_t alloc(uint64_t size) {
+        uint64_t addr = mTop;
+        uint64_t top = addr + ((size + kAlign - 1) & ~(kAlign - 1));
+        if (top > mLimit || top < addr)
+            throw std::exception();
+        mTop = top;
+        return addr;
+    }
+
+    /// 块的容量记录在它前面的 8 字节里
+    uint64_t capacity(uint64_t addr) {
+        return word(addr - kHeader);
+    }
+
+    uint64_t malloc(uint64_t size) {
+        if (size <= kMaxSmall) {
+            int cls = sizeClass(size);
+            uint64_t addr = mFree[cls];
+            if (addr) {
+                mFree[cls] = word(addr);
+                return addr;
+            }
+            addr = alloc(kHeader + (uint64_t(1) << (kMinShift + cls))) + kHeader;
+            word(addr - kHeader) = uint64_t(1) << (kMinShift + cls);
+            return addr;
+        }
+        size = (size + kAlign - 1) & ~(kAlign - 1);
+        auto it = mLarge.lower_bound(size);
+        if (it != mLarge.end()) {
+            uint64_t addr = it->second;
+            mLarge.erase(it);
+            return addr;
+        }
+        uint64_t addr = alloc(kHeader + size) + kHeader;
+        word(addr - kHeader) = size;
+        return addr;
+    }
+
+    /// 分配并清零，数组需要初始值为 0
+    uint64_t calloc(uint64_t size) {
+        uint64_t addr = malloc(size);
+        memset(mBase + addr, 0, size);
+        return addr;
+    }
+
+    void free(uint64_t addr) {
+        if (!addr)
+            return;
+        uint64_t size = capacity(addr);
+        if (size <= kMaxSmall) {
+            int cls = sizeClass(size);
+            word(addr) = mFree[cls];
+            mFree[cls] = addr;
+        } else {
+            mLarge.insert(std::make_pair(size, addr));
+        }
+    }
+
+    /// 保存已经用掉的地址空间和空闲链表
+    /// 大数组往往只写了一部分，全 0 的页不写进文件，恢复时新映射的页本来就是 0
+    void save(CheckpointWriter &out) {
+        std::vector<uint64_t> pages;
+        for (uint64_t page = 0; page < mTop; page += kPage) {
+            uint64_t size = pageBytes(page);
+            const char *data = mBase + page;
+            if (data[0] || memcmp(data, data + 1, size - 1))
+                pages.push_back(page);
+        }
+        out.write(mTop);
+        out.write<uint64_t>(pages.size());
+        for (uint64_t page : pages) {
+            out.write(page);
+            out.write(mBase + page, pageBytes(page));
+        }
+        out.write(mFree, sizeof(mFree));
+        out.write<uint64_t>(mLarge.size());
+        for (auto &block : mLarge) {
+            out.write(block.first);
+            out.write(block.second);
+        }
+    }
+
+    /// 先丢掉现有的所有页，让文件里没有的页恢复成 0
+    void restore(CheckpointReader &in) {
+        madvise(mBase, mLimit, MADV_DONTNEED);
+        mTop = in.read<uint64_t>();
+        in.check(mTop >= kAlign && mTop <= mLimit);
+        uint64_t count = in.read<uint64_t>();
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t page = in.read<uint64_t>();
+            in.check(page < mTop && page % kPage == 0);
+            in.read(mBase + page, pageBytes(page));
+        }
+        in.read(mFree, sizeof(mFree));
+        /// malloc 直接顺着链表指针读写，文件损坏时会越界，所以每一级都走一遍；
+        /// 一级里的块数不会超过地址空间放得下的块数，超过了说明链表有环
+        for (int cls = 0; cls < kClasses; ++cls) {
+            uint64_t size = uint64_t(1) << (kMinShift + cls);
+            uint64_t steps = mTop / (kHeader + size);
+            for (uint64_t addr = mFree[cls]; addr; addr = word(addr))
+                in.check(steps-- && inBounds(addr, size) && capacity(addr) == size);
+        }
+        mLarge.clear();
+        count = in.read<uint64_t>();
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t size = in.read<uint64_t>();
+            uint64_t addr = in.read<uint64_t>();
+            in.check(inBounds(addr, size));
+            mLarge.insert(std::make_pair(size, addr));
+        }
+    }
+};
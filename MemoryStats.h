@@ -0,0 +1,113 @@
+//==--- MemoryStats.h - Per-site accounting of interpreter allocations ----===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// 按分配点统计数组和 MALLOC 的内存使用
+/// 分配点是声明数组的 VarDecl 或者调用 MALLOC 的 CallExpr，降级时登记，编号放在分配指令里
+/// 没有打开时 allocated/freed 只检查一个标志，不记录任何东西
+class MemoryStats {
+    struct Site {
+        std::string name;
+        uint64_t blocks;
+        uint64_t bytes;
+        uint64_t liveBlocks;
+        uint64_t liveBytes;
+    };
+
+    struct Block {
+        int site;
+        uint64_t size;
+    };
+
+    bool mEnabled;
+    std::vector<Site> mSites;
+    /// 还没有释放的块
+    std::unordered_map<uint64_t, Block> mBlocks;
+    uint64_t mLiveBytes;
+    uint64_t mPeakBytes;
+    uint64_t mPeakBlocks;
+    uint64_t mFrees;
+
+public:
+    MemoryStats() : mEnabled(false), mSites(), mBlocks(), mLiveBytes(0), mPeakBytes(0), mPeakBlocks(0), mFrees(0) {
+    }
+
+    void enable() {
+        mEnabled = true;
+    }
+
+    bool enabled() {
+        return mEnabled;
+    }
+
+    /// 返回分配点的编号
+    int addSite(const std::string &name) {
+        mSites.push_back(Site{name, 0, 0, 0, 0});
+        return mSites.size() - 1;
+    }
+
+    void allocated(uint64_t addr, uint64_t size, int site) {
+        if (!mEnabled)
+            return;
+        Site &s = mSites[site];
+        ++s.blocks;
+        s.bytes += size;
+        ++s.liveBlocks;
+        s.liveBytes += size;
+        mBlocks[addr] = Block{site, size};
+        mLiveBytes += size;
+        mPeakBytes = std::max(mPeakBytes, mLiveBytes);
+        mPeakBlocks = std::max<uint64_t>(mPeakBlocks, mBlocks.size());
+    }
+
+    /// 不认识的地址（比如重复释放）不计入
+    void freed(uint64_t addr) {
+        if (!mEnabled)
+            return;
+        auto it = mBlocks.find(addr);
+        if (it == mBlocks.end())
+            return;
+        Site &s = mSites[it->second.site];
+        --s.liveBlocks;
+        s.liveBytes -= it->second.size;
+        mLiveBytes -= it->second.size;
+        ++mFrees;
+        mBlocks.erase(it);
+    }
+
+    /// reserved 是线性地址空间用掉的部分，包括块头、按大小分级浪费的空间和预留的局部数组栈
+    /// 局部数组随调用分配和释放，不按分配点统计，只报告数组栈的峰值
+    void report(llvm::raw_ostream &out, uint64_t reserved, int64_t peakDepth, uint64_t peakStack,
+                uint64_t peakArrays) {
+        out << "peak heap: " << mPeakBytes << " bytes, " << mPeakBlocks << " blocks\n";
+        out << "live at exit: " << mLiveBytes << " bytes, " << mBlocks.size() << " blocks\n";
+        out << "frees: " << mFrees << "\n";
+        out << "address space used: " << reserved << " bytes\n";
+        out << "peak call depth: " << peakDepth << ", peak register stack: " << peakStack << " bytes\n";
+        out << "peak local arrays: " << peakArrays << " bytes\n";
+
+        std::vector<const Site *> sites;
+        for (const Site &site : mSites) {
+            if (site.blocks)
+                sites.push_back(&site);
+        }
+        std::sort(sites.begin(), sites.end(), [](const Site *a, const Site *b) {
+            return a->bytes > b->bytes;
+        });
+        out << "site                                           blocks          bytes    live blocks     live bytes\n";
+        for (const Site *site : sites) {
+            out << llvm::format("%-40s %12llu %14llu %14llu %14llu\n", site->name.c_str(),
+                                (unsigned long long) site->blocks, (unsigned long long) site->bytes,
+                                (unsigned long long) site->liveBlocks, (unsigned long long) site->liveBytes);
+        }
+    }
+};
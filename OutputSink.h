@@ -0,0 +1,162 @@
+//==--- OutputSink.h - Buffered destination for PRINT ---------------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// PRINT 的输出先攒在缓冲区里，满了或者结束时一次 write 写出去，不再每个数字一次系统调用
+/// 目的地可以是文件描述符（stdout、stderr 或者打开的文件），也可以是内存里的字符串，方便嵌入使用
+///
+/// 写到文件描述符的输出登记在一张全局表里，调用 exit 或者因为信号异常结束时也会把缓冲区写出去，
+/// 信号处理函数里只调用 write，然后按默认方式重新触发这个信号
+class OutputSink {
+    static const size_t kBufferSize = 64 << 10;
+    static const int kMaxSinks = 64;
+
+    /// 小于 0 表示写到 mString
+    int mFd;
+    bool mOwned;
+    std::string *mString;
+    std::vector<char> mBuffer;
+    size_t mUsed;
+
+    static std::atomic<OutputSink *> *sinks() {
+        static std::atomic<OutputSink *> table[kMaxSinks];
+        return table;
+    }
+
+    static void writeAll(int fd, const char *data, size_t size) {
+        while (size) {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return;
+            data += n;
+            size -= n;
+        }
+    }
+
+    static void flushAll() {
+        for (int i = 0; i < kMaxSinks; ++i) {
+            if (OutputSink *sink = sinks()[i].load())
+                sink->flush();
+        }
+    }
+
+    static void onSignal(int sig) {
+        flushAll();
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+
+    void attach() {
+        static std::once_flag installed;
+        std::call_once(installed, []() {
+            for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGTERM, SIGINT, SIGHUP})
+                signal(sig, onSignal);
+            atexit(flushAll);
+        });
+        for (int i = 0; i < kMaxSinks; ++i) {
+            OutputSink *empty = NULL;
+            if (sinks()[i].compare_exchange_strong(empty, this))
+                return;
+        }
+    }
+
+    void detach() {
+        for (int i = 0; i < kMaxSinks; ++i) {
+            OutputSink *self = this;
+            if (sinks()[i].compare_exchange_strong(self, NULL))
+                return;
+        }
+    }
+
+public:
+    /// owned 为真时析构时关闭 fd
+    explicit OutputSink(int fd, bool owned = false) : mFd(fd), mOwned(owned), mString(NULL), mBuffer(kBufferSize),
+                                                      mUsed(0) {
+        attach();
+    }
+
+    /// 直接追加到 str 里，不需要缓冲
+    explicit OutputSink(std::string &str) : mFd(-1), mOwned(false), mString(&str), mBuffer(), mUsed(0) {
+    }
+
+    /// 打开失败时抛出异常
+    static int openFile(const std::string &path) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::exception();
+        return fd;
+    }
+
+    ~OutputSink() {
+        if (mFd >= 0) {
+            detach();
+            flush();
+            if (mOwned)
+                ::close(mFd);
+        }
+    }
+
+    OutputSink(const OutputSink &) = delete;
+
+    OutputSink &operator=(const OutputSink &) = delete;
+
+    void write(const char *data, size_t size) {
+        if (mString) {
+            mString->append(data, size);
+            return;
+        }
+        if (mUsed + size > mBuffer.size()) {
+            flush();
+            if (size > mBuffer.size()) {
+                writeAll(mFd, data, size);
+                return;
+            }
+        }
+        memcpy(mBuffer.data() + mUsed, data, size);
+        mUsed += size;
+    }
+
+    /// 把 val 的十进制从 end 往前写，返回第一个字符，end 前面至少要留 20 个字节
+    /// 不分配内存也不用 stdio，信号处理函数里也能用
+    static char *format(char *end, int64_t val) {
+        char *p = end;
+        uint64_t abs = val < 0 ? 0 - uint64_t(val) : uint64_t(val);
+        do {
+            *--p = char('0' + abs % 10);
+            abs /= 10;
+        } while (abs);
+        if (val < 0)
+            *--p = '-';
+        return p;
+    }
+
+    void write(int64_t val) {
+        char digits[24];
+        char *end = digits + sizeof(digits);
+        char *p = format(end, val);
+        write(p, end - p);
+    }
+
+    void flush() {
+        if (mFd >= 0 && mUsed) {
+            writeAll(mFd, mBuffer.data(), mUsed);
+            mUsed = 0;
+        }
+    }
+};
@@ -0,0 +1,120 @@
+//==--- Profiler.h - Per-function profile of interpreted calls -----------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Bytecode.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// 按被解释的函数统计调用次数、包含/不包含子调用的时间和执行的指令数
+/// 同时维护一棵调用树，最后按 flamegraph 的 folded 格式输出每条调用链的独占时间
+/// 计时只发生在调用和返回的时候，不会给每条指令增加开销
+class Profiler {
+    struct Entry {
+        uint64_t calls;
+        uint64_t inclusive;
+        uint64_t exclusive;
+        uint64_t steps;
+        /// 正在执行的层数，递归时只有最外层计入包含时间
+        int active;
+    };
+
+    struct Node {
+        Function *fn;
+        Node *parent;
+        std::map<Function *, Node *> children;
+        uint64_t self;
+    };
+
+    struct Frame {
+        Function *fn;
+        uint64_t start;
+        /// 子调用花掉的时间
+        uint64_t child;
+    };
+
+    std::map<Function *, Entry> mEntries;
+    std::vector<Frame> mFrames;
+    std::vector<std::unique_ptr<Node>> mNodes;
+    Node *mCurrent;
+
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void writeFolded(llvm::raw_ostream &out, Node *node, const std::string &prefix) {
+        std::string path = prefix.empty() ? node->fn->name : prefix + ";" + node->fn->name;
+        if (node->self / 1000)
+            out << path << " " << node->self / 1000 << "\n";
+        for (auto &child : node->children)
+            writeFolded(out, child.second, path);
+    }
+
+public:
+    Profiler() : mEntries(), mFrames(), mNodes(), mCurrent(NULL) {
+        mNodes.emplace_back(new Node{NULL, NULL, {}, 0});
+        mCurrent = mNodes.back().get();
+    }
+
+    void enter(Function *fn) {
+        Node *&node = mCurrent->children[fn];
+        if (!node) {
+            mNodes.emplace_back(new Node{fn, mCurrent, {}, 0});
+            node = mNodes.back().get();
+        }
+        mCurrent = node;
+        Entry &entry = mEntries[fn];
+        ++entry.calls;
+        ++entry.active;
+        mFrames.push_back(Frame{fn, now(), 0});
+    }
+
+    /// steps 是这一次调用自己执行的指令数，不含子调用
+    void exit(uint64_t steps) {
+        Frame frame = mFrames.back();
+        mFrames.pop_back();
+        uint64_t total = now() - frame.start;
+        uint64_t self = total - frame.child;
+
+        Entry &entry = mEntries[frame.fn];
+        entry.exclusive += self;
+        entry.steps += steps;
+        if (--entry.active == 0)
+            entry.inclusive += total;
+        mCurrent->self += self;
+        mCurrent = mCurrent->parent;
+        if (!mFrames.empty())
+            mFrames.back().child += total;
+    }
+
+    /// 按独占时间从大到小输出
+    void report(llvm::raw_ostream &out) {
+        std::vector<std::pair<Function *, Entry>> entries(mEntries.begin(), mEntries.end());
+        std::sort(entries.begin(), entries.end(),
+                  [](const std::pair<Function *, Entry> &a, const std::pair<Function *, Entry> &b) {
+                      return a.second.exclusive > b.second.exclusive;
+                  });
+        out << "function                      calls  inclusive(ms)  exclusive(ms)   instructions\n";
+        for (auto &it : entries) {
+            const Entry &entry = it.second;
+            out << llvm::format("%-24s %10llu %14.3f %14.3f %14llu\n", it.first->name.c_str(),
+                                (unsigned long long) entry.calls, entry.inclusive / 1e6, entry.exclusive / 1e6,
+                                (unsigned long long) entry.steps);
+        }
+    }
+
+    /// 每行是一条调用链和它的独占时间（微秒），可以直接交给 flamegraph.pl
+    void writeFolded(llvm::raw_ostream &out) {
+        for (auto &child : mNodes.front()->children)
+            writeFolded(out, child.second, "");
+    }
+};
@@ -0,0 +1,127 @@
+//==--- Sampler.h - Statistical profile of interpreted source lines ------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Bytecode.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// 定时采样解释器正在执行的位置，按源码行和函数汇总
+/// 计时器到期时信号处理函数只置一个标志，虚拟机在下一条指令之前调用 sample，
+/// 这时调用链是完整的，汇总不需要考虑信号安全
+/// 和 Profiler 不同，调用和返回时不做任何事，开销只和采样频率有关
+class Sampler {
+public:
+    /// 调用链上的一个位置，pc 是正在执行的指令，调用者的 pc 是调用指令
+    struct Location {
+        Function *fn;
+        const Instr *pc;
+    };
+
+    /// 只看最里面这么多层，很深的递归不会让一次采样变慢
+    static const size_t kMaxFrames = 256;
+
+private:
+    /// self 是位置在最里层的样本数，total 是出现在调用链上的样本数，递归时每个样本只算一次
+    struct Count {
+        uint64_t self;
+        uint64_t total;
+        /// 上一次计入 total 的样本编号
+        uint64_t stamp;
+    };
+
+    long mInterval;
+    uint64_t mSamples;
+    std::unordered_map<Function *, Count> mFunctions;
+    std::map<std::pair<Function *, int>, Count> mLines;
+    /// folded 格式的调用链，从外到内用分号连接
+    std::map<std::string, uint64_t> mStacks;
+
+    static int line(const Location &loc) {
+        size_t index = loc.pc - loc.fn->code.data();
+        return index < loc.fn->lines.size() ? loc.fn->lines[index] : 0;
+    }
+
+    void count(Count &count, bool self) {
+        if (self)
+            ++count.self;
+        if (count.stamp != mSamples) {
+            count.stamp = mSamples;
+            ++count.total;
+        }
+    }
+
+    double percent(uint64_t samples) {
+        return mSamples ? 100.0 * samples / mSamples : 0;
+    }
+
+public:
+    /// interval 是采样间隔，单位是微秒的 CPU 时间
+    explicit Sampler(long interval) : mInterval(interval), mSamples(0), mFunctions(), mLines(), mStacks() {
+    }
+
+    long interval() {
+        return mInterval;
+    }
+
+    /// chain 从内到外，truncated 表示更外层的调用被省略了
+    void sample(const std::vector<Location> &chain, bool truncated) {
+        ++mSamples;
+        std::string stack = truncated ? "..." : "";
+        for (size_t i = chain.size(); i-- > 0;) {
+            const Location &loc = chain[i];
+            count(mFunctions[loc.fn], i == 0);
+            count(mLines[std::make_pair(loc.fn, line(loc))], i == 0);
+            if (!stack.empty())
+                stack += ';';
+            stack += loc.fn->name;
+        }
+        ++mStacks[stack];
+    }
+
+    /// 函数和源码行都按独占的样本数从多到少输出，源码行只输出前 lines 个
+    void report(llvm::raw_ostream &out, size_t lines = 20) {
+        out << "samples: " << mSamples << ", every " << mInterval << " us of CPU time\n";
+        std::vector<std::pair<Function *, Count>> functions(mFunctions.begin(), mFunctions.end());
+        std::sort(functions.begin(), functions.end(),
+                  [](const std::pair<Function *, Count> &a, const std::pair<Function *, Count> &b) {
+                      return a.second.self > b.second.self;
+                  });
+        out << "function                   self      self%     total%\n";
+        for (auto &it : functions) {
+            out << llvm::format("%-24s %6llu %9.1f%% %9.1f%%\n", it.first->name.c_str(),
+                                (unsigned long long) it.second.self, percent(it.second.self),
+                                percent(it.second.total));
+        }
+
+        std::vector<std::pair<std::pair<Function *, int>, Count>> hot(mLines.begin(), mLines.end());
+        std::sort(hot.begin(), hot.end(),
+                  [](const std::pair<std::pair<Function *, int>, Count> &a,
+                     const std::pair<std::pair<Function *, int>, Count> &b) {
+                      return a.second.self > b.second.self;
+                  });
+        if (hot.size() > lines)
+            hot.resize(lines);
+        out << "line                       self      self%     total%\n";
+        for (auto &it : hot) {
+            std::string where = it.first.first->name + ":" + std::to_string(it.first.second);
+            out << llvm::format("%-24s %6llu %9.1f%% %9.1f%%\n", where.c_str(),
+                                (unsigned long long) it.second.self, percent(it.second.self),
+                                percent(it.second.total));
+        }
+    }
+
+    /// 每行是一条调用链和它的样本数，可以直接交给 flamegraph.pl
+    void writeFolded(llvm::raw_ostream &out) {
+        for (auto &it : mStacks)
+            out << it.first << " " << it.second << "\n";
+    }
+};
@@ -0,0 +1,197 @@
+//==--- Trace.h - Ring buffer of recently executed instructions ------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "Bytecode.h"
+#include "OutputSink.h"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+/// 最近解释执行的 N 条指令，出错或者收到信号时输出，用来事后排查
+/// 只有用 AST_INTERPRETER_TRACE 编译时虚拟机才会调用 record，否则整个记录路径不存在
+///
+/// 缓冲区大小固定，写满后覆盖最旧的记录；只有解释器线程写，mNext 按 release 发布，
+/// 信号处理函数或者其他线程不加锁就能读到完整的记录
+/// 每条记录是函数、pc、调用深度和指令执行之后 a 寄存器的值，只有写 a 的指令才有这个值
+/// 这个值在记录下一条指令时才补上，所以最后一条记录里是执行之前的值；
+/// 解释执行的调用要等被调函数返回时才补上，还没有返回的调用里也是执行之前的值
+/// JIT 编译的函数不经过解释器，不会出现在记录里
+class Trace {
+    struct Entry {
+        Function *fn;
+        int32_t pc;
+        int32_t depth;
+        int64_t val;
+    };
+
+    std::unique_ptr<Entry[]> mEntries;
+    uint64_t mMask;
+    std::atomic<uint64_t> mNext;
+    /// 上一条记录的指令的 a 寄存器，指令不写 a 时为 NULL
+    int64_t *mDest;
+    /// 还没有返回的解释执行的调用指令的序号，被覆盖的记录也留在这里，返回时跳过
+    std::vector<uint64_t> mCalls;
+    int mFd;
+
+    static std::atomic<Trace *> &active() {
+        static std::atomic<Trace *> trace(NULL);
+        return trace;
+    }
+
+    static struct sigaction *previous() {
+        static struct sigaction actions[NSIG];
+        return actions;
+    }
+
+    /// 先输出记录，再交给之前的处理函数，比如 OutputSink 会写出缓冲的输出后重新触发信号
+    /// SIGUSR2 只输出，程序继续执行
+    static void onSignal(int sig) {
+        if (Trace *trace = active().load())
+            trace->dump();
+        if (sig == SIGUSR2)
+            return;
+        struct sigaction &old = previous()[sig];
+        if (old.sa_handler != SIG_DFL && old.sa_handler != SIG_IGN && !(old.sa_flags & SA_SIGINFO)) {
+            old.sa_handler(sig);
+            return;
+        }
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+
+    static void install() {
+        for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGUSR2}) {
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = onSignal;
+            sigemptyset(&action.sa_mask);
+            sigaction(sig, &action, &previous()[sig]);
+        }
+    }
+
+    /// 信号处理函数里不能用 stdio
+    static char *append(char *p, const char *str) {
+        size_t size = strlen(str);
+        memcpy(p, str, size);
+        return p + size;
+    }
+
+    static char *append(char *p, int64_t val) {
+        char digits[24];
+        char *end = digits + sizeof(digits);
+        char *q = OutputSink::format(end, val);
+        memcpy(p, q, end - q);
+        return p + (end - q);
+    }
+
+    void writeAll(const char *data, size_t size) {
+        while (size) {
+            ssize_t n = ::write(mFd, data, size);
+            if (n <= 0)
+                return;
+            data += n;
+            size -= n;
+        }
+    }
+
+public:
+    /// 环形缓冲区的条数上限，缓冲区在构造时就整块分配
+    static const uint64_t kMaxCapacity = uint64_t(1) << 20;
+
+    /// capacity 向上取整到 2 的幂，超过 kMaxCapacity 的按 kMaxCapacity 算，记录输出到 fd
+    /// 第一个创建的 Trace 负责响应信号
+    explicit Trace(uint64_t capacity, int fd = STDERR_FILENO) : mEntries(), mMask(0), mNext(0), mDest(NULL),
+                                                                mCalls(), mFd(fd) {
+        if (capacity > kMaxCapacity)
+            capacity = kMaxCapacity;
+        uint64_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        mEntries.reset(new Entry[size]());
+        mMask = size - 1;
+        Trace *empty = NULL;
+        if (active().compare_exchange_strong(empty, this))
+            install();
+    }
+
+    ~Trace() {
+        Trace *self = this;
+        active().compare_exchange_strong(self, NULL);
+    }
+
+    Trace(const Trace &) = delete;
+
+    Trace &operator=(const Trace &) = delete;
+
+    /// pc 是即将执行的指令，r 是当前的寄存器
+    void record(Function *fn, const Instr *pc, int64_t depth, int64_t *r) {
+        uint64_t next = mNext.load(std::memory_order_relaxed);
+        if (mDest)
+            mEntries[(next - 1) & mMask].val = *mDest;
+        Entry &entry = mEntries[next & mMask];
+        entry.fn = fn;
+        entry.pc = pc - fn->code.data();
+        entry.depth = depth;
+        mDest = writesA(pc->op) ? &r[pc->a] : NULL;
+        entry.val = mDest ? *mDest : 0;
+        mNext.store(next + 1, std::memory_order_release);
+    }
+
+    /// 上一条记录的调用指令进入了被调函数，结果在 exit 时补上
+    void enter() {
+        mCalls.push_back(mNext.load(std::memory_order_relaxed) - 1);
+        mDest = NULL;
+    }
+
+    /// 解释执行的调用返回了 val，从检查点恢复的调用没有对应的 enter
+    void exit(int64_t val) {
+        if (mCalls.empty())
+            return;
+        uint64_t call = mCalls.back();
+        mCalls.pop_back();
+        if (mNext.load(std::memory_order_relaxed) - call <= mMask + 1)
+            mEntries[call & mMask].val = val;
+    }
+
+    /// 从旧到新每行一条记录：调用深度、函数名和行号、pc、指令和 a 寄存器的值
+    /// 只调用 write，可以在信号处理函数里使用
+    void dump() {
+        uint64_t next = mNext.load(std::memory_order_acquire);
+        uint64_t count = next < mMask + 1 ? next : mMask + 1;
+        char line[256];
+        char *p = append(line, "trace: last ");
+        p = append(p, int64_t(count));
+        p = append(p, " instructions, oldest first\n");
+        writeAll(line, p - line);
+        for (uint64_t i = next - count; i < next; ++i) {
+            const Entry &entry = mEntries[i & mMask];
+            Function *fn = entry.fn;
+            p = append(line, "  depth ");
+            p = append(p, int64_t(entry.depth));
+            p = append(p, "  ");
+            size_t name = std::min<size_t>(fn->name.size(), 64);
+            memcpy(p, fn->name.data(), name);
+            p += name;
+            p = append(p, ":");
+            p = append(p, int64_t(size_t(entry.pc) < fn->lines.size() ? fn->lines[entry.pc] : 0));
+            p = append(p, "  pc ");
+            p = append(p, int64_t(entry.pc));
+            p = append(p, "  ");
+            p = append(p, opcodeName(fn->code[entry.pc].op));
+            if (writesA(fn->code[entry.pc].op)) {
+                p = append(p, "  a = ");
+                p = append(p, entry.val);
+            }
+            p = append(p, "\n");
+            writeAll(line, p - line);
+        }
+    }
+};
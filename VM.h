@@ -0,0 +1,783 @@
+//==--- VM.h - Dispatch loop for the register bytecode --------------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "Bytecode.h"
+#include "Compiler.h"
+#include "Environment.h"
+#include "JIT.h"
+#include "Memo.h"
+#include "Profiler.h"
+#include "Sampler.h"
+#include "Trace.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+/// 调用深度超过上限时抛出，what() 是给用户看的错误信息
+class StackOverflow : public std::exception {
+    std::string mMessage;
+
+public:
+    explicit StackOverflow(int64_t depth)
+            : mMessage("stack overflow at call depth " + std::to_string(depth)) {
+    }
+
+    const char *what() const noexcept override {
+        return mMessage.c_str();
+    }
+};
+
+/// 执行降级后的字节码
+/// 寄存器是 64 位的，int 运算按 32 位回绕，指针就是线性地址空间里的偏移
+///
+/// 所有调用的寄存器都放在同一个连续的值栈上，被调函数的栈帧直接从调用者存放实参的寄存器开始，
+/// 参数不需要拷贝，调用和返回只是移动一下帧指针，不会分配任何内存
+/// 调用不会在宿主栈上递归：调用者的 pc 和帧指针保存在 mFrames 里，返回时再取出来，
+/// 被解释程序的递归深度只受 mMaxDepth 限制，超过时抛出 StackOverflow
+/// 本地代码在宿主栈上递归，宿主栈快用完时把调用交回解释器，递归深度的限制和只解释执行时一样
+class VM {
+    /// 一个还没有返回的调用者
+    struct Frame {
+        Function *fn;
+        Instr *pc;
+        int64_t *r;
+        /// 返回值写到调用者的这个寄存器
+        int ret;
+        /// 调用之前自己执行的指令条数
+        uint64_t steps;
+        /// 被调函数的结果要放进缓存，实参保存在 mMemoArgs 的末尾
+        bool memo;
+    };
+
+    Environment *mEnv;
+    Compiler *mCompiler;
+    int64_t *mGlobals;
+    char *mMem;
+
+    /// 只预留不初始化，没有用到的部分不会占用物理内存
+    static const size_t kStackSize = 1 << 24;
+    std::unique_ptr<int64_t[]> mStack;
+    std::vector<Frame> mFrames;
+    /// 正在执行的调用层数，包括本地代码里的调用
+    int64_t mDepth;
+    /// 局部数组栈在线性地址空间里，第一次用到时预留，每个调用在上面占一段数组区
+    static const int64_t kArrayStackSize = int64_t(256) << 20;
+    int64_t mArrayBase;
+    int64_t mArrayTop;
+    /// 解释执行时到达过的最大调用深度、寄存器栈的最高位置和数组栈用到的最大字节数
+    int64_t mPeakDepth;
+    int64_t *mPeakStack;
+    int64_t mPeakArrays;
+    int64_t mMaxDepth;
+    /// 已经执行的指令条数
+    uint64_t mSteps;
+    /// 不为空时在每次调用和返回时记录
+    Profiler *mProfiler;
+    /// 不为空时按 SIGPROF 定时采样
+    Sampler *mSampler;
+    /// 采样时复用的调用链
+    std::vector<Sampler::Location> mChain;
+    /// 不为空时缓存递归纯函数的结果
+    /// 只有 mPurity 会设置 Function::memoize，它和 mMemo 同时存在，所以执行到 memoize 的函数时 mMemo 一定不为空
+    MemoCache *mMemo;
+    std::unique_ptr<PurityAnalysis> mPurity;
+    /// 正在执行的被缓存函数的实参，被调函数可能改写参数寄存器，所以调用时先复制一份
+    std::vector<int64_t> mMemoArgs;
+    /// 被调用这么多次的函数交给 JIT 编译，0 表示只解释执行
+    unsigned mJITThreshold;
+    /// 宿主栈用到这里以下时不再进入本地代码
+    char *mHostLimit;
+    /// 正在执行的最外层本地代码的寄存器窗口，本地代码不用寄存器栈，交回来的调用从这里开始放
+    int64_t *mNativeFrame;
+    /// 本地代码交回来、正在解释执行的调用层数，这时宿主栈上还有本地代码的栈帧，不能保存检查点
+    int mNested;
+    /// 检查点文件，为空表示 CHECKPOINT() 什么也不做
+    std::string mCheckpointFile;
+    /// 源码的哈希，写在检查点文件开头
+    uint64_t mProgram;
+#ifdef AST_INTERPRETER_JIT
+    std::unique_ptr<JIT> mJIT;
+#endif
+#ifdef AST_INTERPRETER_TRACE
+    /// 不为空时记录每条解释执行的指令
+    Trace *mTrace;
+#endif
+
+    static int64_t i32(int64_t val) {
+        return int32_t(uint32_t(val));
+    }
+
+    /// 用 memcpy 访存，不要求地址按类型对齐
+    template<typename T>
+    int64_t load(int64_t addr) {
+        T val;
+        memcpy(&val, mMem + addr, sizeof(T));
+        return val;
+    }
+
+    template<typename T>
+    void store(int64_t addr, int64_t val) {
+        T narrow = T(val);
+        memcpy(mMem + addr, &narrow, sizeof(T));
+    }
+
+    void overflow() {
+        throw StackOverflow(mDepth);
+    }
+
+    /// 本地代码用的是当前线程的栈，离栈底还剩这么多时就改为解释执行，留给解释器、内置函数和异常处理使用
+    static const size_t kHostStackReserve = 256 << 10;
+
+    static char *hostStackLimit() {
+        pthread_attr_t attr;
+        void *addr = NULL;
+        size_t size = 0;
+        if (!pthread_getattr_np(pthread_self(), &attr)) {
+            pthread_attr_getstack(&attr, &addr, &size);
+            pthread_attr_destroy(&attr);
+        }
+        return addr ? static_cast<char *>(addr) + kHostStackReserve : NULL;
+    }
+
+    /// 编译失败的函数继续解释执行，calls 已经越过阈值，不会再次尝试
+    bool compile(Function *fn) {
+#ifdef AST_INTERPRETER_JIT
+        if (!mJIT) {
+            JITRuntime runtime;
+            runtime.memory = mEnv->getMemory().base();
+            runtime.globals = mEnv->getGlobals();
+            runtime.context = this;
+            runtime.input = [](void *vm) -> int64_t {
+                return static_cast<VM *>(vm)->mEnv->input();
+            };
+            runtime.output = [](void *vm, int64_t val) {
+                static_cast<VM *>(vm)->mEnv->output(val);
+            };
+            runtime.allocHeap = [](void *vm, int64_t size, int64_t site) -> int64_t {
+                return static_cast<VM *>(vm)->mEnv->allocHeap(size, site);
+            };
+            runtime.freeHeap = [](void *vm, int64_t ptr) {
+                static_cast<VM *>(vm)->mEnv->freeHeap(ptr);
+            };
+            runtime.pushArrays = [](void *vm, int64_t bytes) -> int64_t {
+                return static_cast<VM *>(vm)->pushArrays(bytes);
+            };
+            runtime.arrayTop = &mArrayTop;
+            runtime.depth = &mDepth;
+            runtime.maxDepth = mMaxDepth;
+            runtime.overflow = [](void *vm) {
+                static_cast<VM *>(vm)->overflow();
+            };
+            mHostLimit = hostStackLimit();
+            runtime.stackLimit = mHostLimit;
+            runtime.interpret = [](void *vm, int64_t fn, int64_t args) -> int64_t {
+                return static_cast<VM *>(vm)->interpretCall(reinterpret_cast<Function *>(fn),
+                                                            reinterpret_cast<const int64_t *>(args));
+            };
+            mJIT.reset(new JIT(runtime, [this](clang::FunctionDecl *decl) {
+                return resolve(decl);
+            }));
+        }
+        return mJIT->compile(fn);
+#else
+        return false;
+#endif
+    }
+
+    /// 在数组栈上分配一个调用的数组区，返回它的地址，返回时把 mArrayTop 退回这里
+    int64_t pushArrays(int64_t bytes) {
+        if (!mArrayBase)
+            mArrayBase = mArrayTop = mEnv->getMemory().alloc(kArrayStackSize);
+        int64_t base = mArrayTop;
+        if (base + bytes > mArrayBase + kArrayStackSize)
+            overflow();
+        mArrayTop = base + bytes;
+        mPeakArrays = std::max(mPeakArrays, mArrayTop - mArrayBase);
+        return base;
+    }
+
+    /// 降级被调函数，打开了结果缓存时顺便分析它是不是可以缓存
+    Function *resolve(clang::FunctionDecl *decl) {
+        Function *fn = mCompiler->getFunction(decl);
+        if (mPurity)
+            mPurity->analyze(fn);
+        return fn;
+    }
+
+    /// 已经有本地代码，或者这次调用使它变热并且编译成功
+    /// 宿主栈快用完时（只会出现在本地代码交回来的调用里）继续解释执行
+    bool native(Function *fn) {
+        if (!fn->native && !(mJITThreshold && ++fn->calls == mJITThreshold && compile(fn)))
+            return false;
+        return static_cast<char *>(__builtin_frame_address(0)) > mHostLimit;
+    }
+
+    /// frame 以上的寄存器栈在本地代码返回之前都是空闲的
+    int64_t callNative(Function *fn, int64_t *frame) {
+        int64_t *outer = mNativeFrame;
+        mNativeFrame = frame;
+        int64_t val = fn->native(frame);
+        mNativeFrame = outer;
+        return val;
+    }
+
+    /// 本地代码发现宿主栈快用完时把调用交回来，这次调用和它下面的调用都在寄存器栈上解释执行
+    int64_t interpretCall(Function *fn, const int64_t *args) {
+        int64_t *r = mNativeFrame;
+        if (mDepth >= mMaxDepth || r + fn->numRegs > mStack.get() + kStackSize)
+            overflow();
+        std::copy(args, args + fn->numParams, r);
+        if (++mDepth > mPeakDepth)
+            mPeakDepth = mDepth;
+        if (r + fn->numRegs > mPeakStack)
+            mPeakStack = r + fn->numRegs;
+        if (fn->arrayBytes)
+            pushArrays(fn->arrayBytes);
+        ++mNested;
+        int64_t val = execute(fn, fn->code.data(), r, 0, mFrames.size());
+        --mNested;
+        --mDepth;
+        /// 期间收到的 SIGUSR1 留到回到最外层的解释循环时处理
+        if (interrupts().checkpoint)
+            interrupts().pending = 1;
+        return val;
+    }
+
+    /// 信号处理函数只置位这些标志，打开了检查点或者采样时，解释器在下一条指令之前处理
+    struct Interrupts {
+        volatile sig_atomic_t pending;
+        /// SIGUSR1：保存检查点
+        volatile sig_atomic_t checkpoint;
+        /// SIGPROF：采样
+        volatile sig_atomic_t sample;
+    };
+
+    static Interrupts &interrupts() {
+        static Interrupts flags = {0, 0, 0};
+        return flags;
+    }
+
+    static void onCheckpointSignal(int) {
+        interrupts().checkpoint = 1;
+        interrupts().pending = 1;
+    }
+
+    static void onSampleSignal(int) {
+        interrupts().sample = 1;
+        interrupts().pending = 1;
+    }
+
+    /// 两条指令之间 fn、pc、r 就是完整的执行状态，调用者的 pc 在 mFrames 里
+    void interrupt(Function *fn, Instr *pc, int64_t *r, uint64_t steps) {
+        Interrupts &flags = interrupts();
+        flags.pending = 0;
+        if (flags.sample) {
+            flags.sample = 0;
+            if (mSampler) {
+                mChain.clear();
+                mChain.push_back(Sampler::Location{fn, pc});
+                for (size_t i = mFrames.size(); i-- > 0 && mChain.size() < Sampler::kMaxFrames;)
+                    mChain.push_back(Sampler::Location{mFrames[i].fn, mFrames[i].pc - 1});
+                mSampler->sample(mChain, mChain.size() < mFrames.size() + 1);
+            }
+        }
+        if (flags.checkpoint && !mNested) {
+            flags.checkpoint = 0;
+            if (!mCheckpointFile.empty())
+                checkpoint(fn, pc, r, steps);
+        }
+    }
+
+    void saveFrame(CheckpointWriter &out, Function *fn, Instr *pc, int64_t *r, uint64_t steps) {
+        out.writeString(fn->name);
+        out.write<uint64_t>(pc - fn->code.data());
+        out.write<uint64_t>(r - mStack.get());
+        out.write(steps);
+    }
+
+    Function *restoreFunction(CheckpointReader &in) {
+        FunctionDecl *decl = mEnv->getFunction(in.readString());
+        in.check(decl && decl->hasBody());
+        return resolve(decl);
+    }
+
+    /// 恢复一个栈帧，pc 和寄存器都必须落在合法的范围里
+    void restoreFrame(CheckpointReader &in, Function *&fn, Instr *&pc, int64_t *&r, uint64_t &steps) {
+        fn = restoreFunction(in);
+        uint64_t offset = in.read<uint64_t>();
+        in.check(offset < fn->code.size());
+        pc = fn->code.data() + offset;
+        offset = in.read<uint64_t>();
+        in.check(offset + fn->numRegs <= kStackSize);
+        r = mStack.get() + offset;
+        steps = in.read<uint64_t>();
+    }
+
+    /// 所有调用都在解释执行，栈帧里只有函数名、pc 和寄存器的偏移，和地址无关
+    /// fn、pc、r 和 steps 是当前正在执行的函数，恢复后从 pc 继续
+    void checkpoint(Function *fn, Instr *pc, int64_t *r, uint64_t steps) {
+        mEnv->flushOutput();
+        CheckpointWriter out(mCheckpointFile, mProgram);
+        mEnv->save(out);
+        out.write(mSteps);
+        out.write<uint64_t>(mFrames.size());
+        for (const Frame &frame : mFrames) {
+            saveFrame(out, frame.fn, frame.pc, frame.r, frame.steps);
+            out.write(frame.ret);
+            out.write(frame.memo);
+        }
+        out.write<uint64_t>(mMemoArgs.size());
+        out.write(mMemoArgs.data(), mMemoArgs.size() * sizeof(int64_t));
+        out.write(mArrayBase);
+        out.write(mArrayTop);
+        saveFrame(out, fn, pc, r, steps);
+        uint64_t used = r + fn->numRegs - mStack.get();
+        out.write(used);
+        out.write(mStack.get(), used * sizeof(int64_t));
+        out.commit();
+    }
+
+    void start() {
+        mGlobals = mEnv->getGlobals();
+        mMem = mEnv->getMemory().base();
+        mFrames.clear();
+        mMemoArgs.clear();
+        mArrayTop = mArrayBase;
+        mDepth = mPeakDepth = 1;
+        mNativeFrame = mStack.get();
+        mNested = 0;
+    }
+
+public:
+    static const int64_t kDefaultMaxDepth = 100000;
+
+    VM(Environment *env, Compiler *compiler) : mEnv(env), mCompiler(compiler), mGlobals(NULL), mMem(NULL),
+                                               mStack(new int64_t[kStackSize]), mFrames(), mDepth(0), mArrayBase(0),
+                                               mArrayTop(0), mPeakDepth(0), mPeakStack(NULL), mPeakArrays(0),
+                                               mMaxDepth(kDefaultMaxDepth), mSteps(0), mProfiler(NULL), mSampler(NULL), mChain(),
+                                               mMemo(NULL), mPurity(), mMemoArgs(), mJITThreshold(0), mHostLimit(NULL),
+                                               mNativeFrame(NULL), mNested(0), mCheckpointFile(), mProgram(0) {
+#ifdef AST_INTERPRETER_TRACE
+        mTrace = NULL;
+#endif
+    }
+
+    void setProfiler(Profiler *profiler) {
+        mProfiler = profiler;
+    }
+
+    /// 需要在第一次执行之前设置，按 sampler 的间隔启动 SIGPROF 计时器，传 NULL 时停止
+    /// 本地代码里不会处理采样请求，调用方应该关闭 JIT
+    void setSampler(Sampler *sampler) {
+        mSampler = sampler;
+        struct itimerval timer;
+        memset(&timer, 0, sizeof(timer));
+        if (sampler) {
+            signal(SIGPROF, onSampleSignal);
+            timer.it_interval.tv_sec = sampler->interval() / 1000000;
+            timer.it_interval.tv_usec = sampler->interval() % 1000000;
+            timer.it_value = timer.it_interval;
+        }
+        setitimer(ITIMER_PROF, &timer, NULL);
+    }
+
+#ifdef AST_INTERPRETER_TRACE
+    void setTrace(Trace *trace) {
+        mTrace = trace;
+    }
+#endif
+
+    /// 需要在第一次执行之前设置，被缓存的函数总是解释执行
+    /// 设为 NULL 以后不能再执行已经标记了 memoize 的函数
+    void setMemoCache(MemoCache *memo) {
+        mMemo = memo;
+        if (memo) {
+            mPurity.reset(new PurityAnalysis([this](clang::FunctionDecl *decl) {
+                return resolve(decl);
+            }));
+        } else {
+            mPurity.reset();
+        }
+    }
+
+    /// 本地代码不经过 Profiler，也不计入 getSteps
+    void setJITThreshold(unsigned threshold) {
+        mJITThreshold = threshold;
+    }
+
+    /// 需要在第一次执行之前设置，JIT 编译的代码里直接使用这个值
+    void setMaxDepth(int64_t depth) {
+        mMaxDepth = depth;
+    }
+
+    uint64_t getSteps() {
+        return mSteps;
+    }
+
+    int64_t getPeakDepth() {
+        return mPeakDepth;
+    }
+
+    /// 寄存器栈用到的最大字节数
+    uint64_t getPeakStack() {
+        return mPeakStack ? (mPeakStack - mStack.get()) * sizeof(int64_t) : 0;
+    }
+
+    /// 局部数组栈用到的最大字节数，包括本地代码里的调用
+    uint64_t getPeakArrays() {
+        return mPeakArrays;
+    }
+
+    /// 程序调用 CHECKPOINT() 或者进程收到 SIGUSR1 时把执行状态保存到 path
+    /// program 用来确认恢复时的源码和保存时一样
+    /// 信号在解释执行的下一条指令之前处理，含有 CHECKPOINT() 的函数不交给 JIT 编译
+    void setCheckpoint(const std::string &path, uint64_t program) {
+        mCheckpointFile = path;
+        mProgram = program;
+        signal(SIGUSR1, onCheckpointSignal);
+    }
+
+    /// 执行 main
+    int64_t run(Function *fn) {
+        start();
+        int64_t *r = mStack.get();
+        /// 本地代码的入口自己把调用深度加一，main 和解释执行时一样在第 1 层
+        if (native(fn)) {
+            mDepth = 0;
+            return callNative(fn, r);
+        }
+        if (r + fn->numRegs > mStack.get() + kStackSize)
+            overflow();
+        mPeakStack = r + fn->numRegs;
+        if (fn->arrayBytes)
+            pushArrays(fn->arrayBytes);
+        if (mProfiler)
+            mProfiler->enter(fn);
+        return execute(fn, fn->code.data(), r, 0, 0);
+    }
+
+    /// 从 path 恢复执行状态，从保存时的下一条指令继续执行
+    /// 环境需要已经用同样的源码 init 过，PRINT 的输出不会重复
+    int64_t resume(const std::string &path, uint64_t program) {
+        start();
+        CheckpointReader in(path, program);
+        mEnv->restore(in);
+        mSteps = in.read<uint64_t>();
+        uint64_t count = in.read<uint64_t>();
+        in.check(count < uint64_t(mMaxDepth));
+        for (uint64_t i = 0; i < count; ++i) {
+            Frame frame;
+            restoreFrame(in, frame.fn, frame.pc, frame.r, frame.steps);
+            /// 调用者停在调用指令的下一条，返回值写到调用者的寄存器 ret 里
+            in.check(frame.pc > frame.fn->code.data() &&
+                     (frame.pc[-1].op == OP_CALL || frame.pc[-1].op == OP_CALLQ));
+            frame.ret = in.read<int>();
+            in.check(frame.ret >= 0 && frame.ret < frame.fn->numRegs && frame.ret == frame.pc[-1].a);
+            uint8_t memo = in.read<uint8_t>();
+            in.check(memo <= 1);
+            frame.memo = memo;
+            mFrames.push_back(frame);
+            if (mProfiler)
+                mProfiler->enter(frame.fn);
+        }
+        mMemoArgs.resize(in.readCount(sizeof(int64_t)));
+        in.read(mMemoArgs.data(), mMemoArgs.size() * sizeof(int64_t));
+        mArrayBase = in.read<int64_t>();
+        mArrayTop = in.read<int64_t>();
+        in.check(mArrayTop >= mArrayBase && mArrayTop <= mArrayBase + kArrayStackSize &&
+                 (!mArrayBase || uint64_t(mArrayBase + kArrayStackSize) <= mEnv->getMemory().used()));
+        Function *fn;
+        Instr *pc;
+        int64_t *r;
+        uint64_t steps;
+        restoreFrame(in, fn, pc, r, steps);
+        /// 被缓存的调用在返回时从 mMemoArgs 末尾取走被调函数的参数
+        uint64_t memoArgs = 0;
+        for (size_t i = 0; i < mFrames.size(); ++i) {
+            if (mFrames[i].memo)
+                memoArgs += (i + 1 < mFrames.size() ? mFrames[i + 1].fn : fn)->numParams;
+        }
+        in.check(memoArgs == mMemoArgs.size());
+        if (mProfiler)
+            mProfiler->enter(fn);
+        uint64_t used = in.read<uint64_t>();
+        in.check(used == uint64_t(r + fn->numRegs - mStack.get()));
+        in.read(mStack.get(), used * sizeof(int64_t));
+        mDepth = mPeakDepth = count + 1;
+        mPeakStack = r + fn->numRegs;
+        return execute(fn, pc, r, steps, 0);
+    }
+
+private:
+    /// 解释执行，直到 mFrames 里只剩下 base 个调用者时 fn 返回
+    /// 只有打开了检查点或者采样时才使用每条指令之前检查信号标志的版本，平时的解释循环没有这个开销
+    int64_t execute(Function *fn, Instr *pc, int64_t *r, uint64_t steps, size_t base) {
+        if (!mCheckpointFile.empty() || mSampler)
+            return dispatch<true>(fn, pc, r, steps, base);
+        return dispatch<false>(fn, pc, r, steps, base);
+    }
+
+    template<bool kPoll>
+    int64_t dispatch(Function *fn, Instr *pc, int64_t *r, uint64_t steps, size_t base) {
+        int64_t *limit = mStack.get() + kStackSize;
+        Instr *code = fn->code.data();
+        for (;;) {
+            if (kPoll && interrupts().pending)
+                interrupt(fn, pc, r, steps);
+#ifdef AST_INTERPRETER_TRACE
+            if (mTrace)
+                mTrace->record(fn, pc, mDepth, r);
+#endif
+            const Instr &in = *pc++;
+            ++steps;
+            switch (in.op) {
+                case OP_CONST:
+                    r[in.a] = in.b;
+                    break;
+                case OP_MOV:
+                    r[in.a] = r[in.b];
+                    break;
+                case OP_LOADGLOBAL:
+                    r[in.a] = mGlobals[in.b];
+                    break;
+                case OP_STOREGLOBAL:
+                    mGlobals[in.a] = r[in.b];
+                    break;
+                /// 数组区在调用时已经分配好，每次执行到声明时清零，循环里的数组每次迭代都是新的
+                case OP_ALLOCA:
+                    r[in.a] = mArrayTop - fn->arrayBytes + in.c;
+                    memset(mMem + r[in.a], 0, in.b);
+                    break;
+                case OP_ADD:
+                    r[in.a] = i32(r[in.b] + r[in.c]);
+                    break;
+                case OP_SUB:
+                    r[in.a] = i32(r[in.b] - r[in.c]);
+                    break;
+                case OP_MUL:
+                    r[in.a] = i32(r[in.b] * r[in.c]);
+                    break;
+                case OP_DIV:
+                    r[in.a] = r[in.b] / r[in.c];
+                    break;
+                case OP_REM:
+                    r[in.a] = r[in.b] % r[in.c];
+                    break;
+                case OP_LT:
+                    r[in.a] = r[in.b] < r[in.c];
+                    break;
+                case OP_LE:
+                    r[in.a] = r[in.b] <= r[in.c];
+                    break;
+                case OP_GT:
+                    r[in.a] = r[in.b] > r[in.c];
+                    break;
+                case OP_GE:
+                    r[in.a] = r[in.b] >= r[in.c];
+                    break;
+                case OP_EQ:
+                    r[in.a] = r[in.b] == r[in.c];
+                    break;
+                case OP_NE:
+                    r[in.a] = r[in.b] != r[in.c];
+                    break;
+                case OP_NEG:
+                    r[in.a] = i32(-r[in.b]);
+                    break;
+                case OP_ADDI:
+                    r[in.a] = i32(r[in.b] + in.c);
+                    break;
+                case OP_SEXT8:
+                    r[in.a] = int8_t(r[in.b]);
+                    break;
+                case OP_SEXT16:
+                    r[in.a] = int16_t(r[in.b]);
+                    break;
+                case OP_PTRADD:
+                    r[in.a] = r[in.b] + r[in.c] * in.scale;
+                    break;
+                case OP_PTRSUB:
+                    r[in.a] = r[in.b] - r[in.c] * in.scale;
+                    break;
+                case OP_LOAD8:
+                    r[in.a] = load<int8_t>(r[in.b]);
+                    break;
+                case OP_LOAD16:
+                    r[in.a] = load<int16_t>(r[in.b]);
+                    break;
+                case OP_LOAD32:
+                    r[in.a] = load<int32_t>(r[in.b]);
+                    break;
+                case OP_LOAD64:
+                    r[in.a] = load<int64_t>(r[in.b]);
+                    break;
+                case OP_STORE8:
+                    store<int8_t>(r[in.a], r[in.b]);
+                    break;
+                case OP_STORE16:
+                    store<int16_t>(r[in.a], r[in.b]);
+                    break;
+                case OP_STORE32:
+                    store<int32_t>(r[in.a], r[in.b]);
+                    break;
+                case OP_STORE64:
+                    store<int64_t>(r[in.a], r[in.b]);
+                    break;
+                case OP_JMP:
+                    pc = code + in.a;
+                    break;
+                case OP_JZ:
+                    if (!r[in.a])
+                        pc = code + in.b;
+                    break;
+                case OP_JNZ:
+                    if (r[in.a])
+                        pc = code + in.b;
+                    break;
+                case OP_JLT:
+                    if (r[in.a] < r[in.b])
+                        pc = code + in.c;
+                    break;
+                case OP_JLE:
+                    if (r[in.a] <= r[in.b])
+                        pc = code + in.c;
+                    break;
+                case OP_JGT:
+                    if (r[in.a] > r[in.b])
+                        pc = code + in.c;
+                    break;
+                case OP_JGE:
+                    if (r[in.a] >= r[in.b])
+                        pc = code + in.c;
+                    break;
+                case OP_JEQ:
+                    if (r[in.a] == r[in.b])
+                        pc = code + in.c;
+                    break;
+                case OP_JNE:
+                    if (r[in.a] != r[in.b])
+                        pc = code + in.c;
+                    break;
+                case OP_JLTI:
+                    if (r[in.a] < in.b)
+                        pc = code + in.c;
+                    break;
+                case OP_JLEI:
+                    if (r[in.a] <= in.b)
+                        pc = code + in.c;
+                    break;
+                case OP_JGTI:
+                    if (r[in.a] > in.b)
+                        pc = code + in.c;
+                    break;
+                case OP_JGEI:
+                    if (r[in.a] >= in.b)
+                        pc = code + in.c;
+                    break;
+                case OP_JEQI:
+                    if (r[in.a] == in.b)
+                        pc = code + in.c;
+                    break;
+                case OP_JNEI:
+                    if (r[in.a] != in.b)
+                        pc = code + in.c;
+                    break;
+                /// 第一次执行时解析并降级被调函数，然后把指令改写成 OP_CALLQ，之后不再查找
+                case OP_CALL:
+                    fn->target(in.b, [this](clang::FunctionDecl *decl) {
+                        return resolve(decl);
+                    });
+                    pc[-1].op = OP_CALLQ;
+                    // fall through
+                case OP_CALLQ: {
+                    Function *callee = fn->targets[in.b];
+                    int64_t *frame = r + in.c;
+                    if (callee->memoize) {
+                        if (mMemo->lookup(callee, frame, r[in.a]))
+                            break;
+                        mMemoArgs.insert(mMemoArgs.end(), frame, frame + callee->numParams);
+                    } else if (native(callee)) {
+                        r[in.a] = callNative(callee, frame);
+                        break;
+                    }
+                    if (mDepth >= mMaxDepth || frame + callee->numRegs > limit)
+                        overflow();
+                    if (callee->arrayBytes)
+                        pushArrays(callee->arrayBytes);
+                    mFrames.push_back(Frame{fn, pc, r, in.a, steps, callee->memoize});
+                    if (++mDepth > mPeakDepth)
+                        mPeakDepth = mDepth;
+                    if (frame + callee->numRegs > mPeakStack)
+                        mPeakStack = frame + callee->numRegs;
+                    if (mProfiler)
+                        mProfiler->enter(callee);
+#ifdef AST_INTERPRETER_TRACE
+                    if (mTrace)
+                        mTrace->enter();
+#endif
+                    fn = callee;
+                    code = pc = fn->code.data();
+                    r = frame;
+                    steps = 0;
+                    break;
+                }
+                case OP_RET:
+                case OP_RETVOID: {
+                    int64_t val = in.op == OP_RET ? r[in.a] : 0;
+                    mArrayTop -= fn->arrayBytes;
+                    mSteps += steps;
+                    if (mProfiler)
+                        mProfiler->exit(steps);
+                    if (mFrames.size() == base)
+                        return val;
+                    const Frame &caller = mFrames.back();
+                    if (caller.memo) {
+                        size_t args = mMemoArgs.size() - fn->numParams;
+                        mMemo->insert(fn, &mMemoArgs[args], val);
+                        mMemoArgs.resize(args);
+                    }
+                    fn = caller.fn;
+                    code = fn->code.data();
+                    pc = caller.pc;
+                    r = caller.r;
+                    r[caller.ret] = val;
+#ifdef AST_INTERPRETER_TRACE
+                    if (mTrace)
+                        mTrace->exit(val);
+#endif
+                    steps = caller.steps;
+                    mFrames.pop_back();
+                    --mDepth;
+                    break;
+                }
+                case OP_INPUT:
+                    r[in.a] = mEnv->input();
+                    break;
+                case OP_PRINT:
+                    mEnv->output(r[in.a]);
+                    break;
+                case OP_MALLOC:
+                    r[in.a] = mEnv->allocHeap(r[in.b], in.c);
+                    break;
+                case OP_FREE:
+                    mEnv->freeHeap(r[in.a]);
+                    break;
+                case OP_CHECKPOINT:
+                    if (!mCheckpointFile.empty())
+                        checkpoint(fn, pc, r, steps);
+                    break;
+                case OP_COUNT:
+                    ++fn->counts[in.a];
+                    break;
+                default:
+                    throw std::exception();
+            }
+        }
+    }
+};
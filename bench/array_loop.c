@@ -0,0 +1,23 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int a[1000];
+
+int main() {
+    int i;
+    int j;
+    int sum = 0;
+    for (i = 0; i < 1000; i = i + 1) {
+        a[i] = i;
+    }
+    for (j = 0; j < 2000; j = j + 1) {
+        for (i = 1; i < 1000; i = i + 1) {
+            a[i] = (a[i - 1] + a[i] * 3) % 1000;
+        }
+        sum = (sum + a[999]) % 100000;
+    }
+    PRINT(sum);
+    return 0;
+}
@@ -0,0 +1,22 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int add(int x, int y) {
+    return x + y;
+}
+
+int mix(int x, int y) {
+    return add(x * 3, y) % 1009;
+}
+
+int main() {
+    int i;
+    int acc = 0;
+    for (i = 0; i < 300000; i = i + 1) {
+        acc = mix(acc, i);
+    }
+    PRINT(acc);
+    return 0;
+}
@@ -0,0 +1,38 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+/// 每个节点两个指针：[0] 指向下一个节点，[1] 指向存放值的整数
+int main() {
+    int **head;
+    int **node;
+    int **next;
+    int *value;
+    int i;
+    int round;
+    int sum = 0;
+
+    head = (int **)MALLOC(sizeof(int *) * 2);
+    value = (int *)MALLOC(sizeof(int));
+    *value = 0;
+    head[1] = value;
+    node = head;
+    for (i = 1; i < 5000; i = i + 1) {
+        next = (int **)MALLOC(sizeof(int *) * 2);
+        value = (int *)MALLOC(sizeof(int));
+        *value = i;
+        next[1] = value;
+        node[0] = (int *)next;
+        node = next;
+    }
+    node[0] = (int *)head;
+
+    node = head;
+    for (round = 0; round < 200000; round = round + 1) {
+        sum = (sum + *node[1]) % 1000003;
+        node = (int **)node[0];
+    }
+    PRINT(sum);
+    return 0;
+}
@@ -0,0 +1,20 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+/// 测的是调用和返回的开销：fib 写全局变量，不是纯函数，--memo 也不会缓存它
+int calls;
+
+int fib(int n) {
+    calls = calls + 1;
+    if (n < 2)
+        return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+int main() {
+    PRINT(fib(27));
+    PRINT(calls);
+    return 0;
+}
@@ -25,3 +25,78 @@ while [ $((i)) -lt 25 ]; do
     echo 0
   fi
 done
+
+bin=/home/black/ast-interpreter/cmake-build-debug/ast-interpreter
+dir=/home/black/ast-interpreter/test
+
+# 下面的测试要带参数或者运行多次，只比较输出（包括 stderr），不看退出码，出错的路径也要能测
+check() {
+  name="$1"
+  answer="$2"
+  shift 2
+  printf "%s\t" "$name"
+  output="$("$@" 2>&1)"
+  printf "%s\t%s\t" "$output" "$answer"
+  if [ "$output" = "$answer" ]; then
+    echo 1
+  else
+    echo -1
+  fi
+}
+
+# 用空的缓存目录把同一个程序运行两次，第二次必须命中缓存：缓存文件没有被重新写过，输出也和第一次一样
+cached() {
+  cache="$(mktemp -d)"
+  first="$(AST_INTERPRETER_CACHE="$cache" "$bin" "$(cat "$1")" 2>&1)"
+  before="$(ls -i "$cache")"
+  second="$(AST_INTERPRETER_CACHE="$cache" "$bin" "$(cat "$1")" 2>&1)"
+  after="$(ls -i "$cache")"
+  rm -rf "$cache"
+  if [ -n "$before" ] && [ "$before" = "$after" ] && [ "$first" = "$second" ]; then
+    echo "$second"
+  else
+    echo "cache miss"
+  fi
+}
+
+check cache "33312826232118161311863491419242934" cached "$dir/test21.c"
+
+# 递归深度只受 --max-depth 限制，JIT 编译的代码在宿主栈不够时交回解释器，两个执行层的结果一样
+check deep "446198416" "$bin" --max-depth=1000000 "$(cat "$dir/test25.c")"
+check deep-no-jit "446198416" "$bin" --max-depth=1000000 --no-jit "$(cat "$dir/test25.c")"
+check overflow "stack overflow at call depth 100000" "$bin" "$(cat "$dir/test26.c")"
+check overflow-no-jit "stack overflow at call depth 100000" "$bin" --no-jit "$(cat "$dir/test26.c")"
+
+# 转换成 char 和 short 时截断，常量折叠和运行时的结果一样
+check narrow "44-2553644127446445" "$bin" "$(cat "$dir/test27.c")"
+
+# 多层循环里的 break 和 continue 只作用于最近的一层，循环里的 return 直接结束函数
+check loops "0310287206" "$bin" "$(cat "$dir/test28.c")"
+
+# FREE 掉的块会被下一次同样大小的 MALLOC 复用，反复分配释放不会用完地址空间
+check free "1000" "$bin" "$(cat "$dir/test29.c")"
+
+# 同时存在 2 万个分配的块，指针不再受 base%10000 编码的限制
+check allocations "01234539998" "$bin" "$(cat "$dir/test30.c")"
+
+# 打开结果缓存不能改变输出：纯函数的结果被复用，写全局变量的函数每次都要执行；缓存很小时会互相覆盖
+check memo-off "46368546368546368518" "$bin" "$(cat "$dir/test31.c")"
+check memo "46368546368546368518" "$bin" --memo "$(cat "$dir/test31.c")"
+check memo-small "46368546368546368518" "$bin" --memo=16 "$(cat "$dir/test31.c")"
+
+# 在递归的最深处保存检查点，再从检查点恢复：恢复后只输出检查点之后的部分，全局内存和局部数组都要恢复
+restored() {
+  file="$(mktemp)"
+  first="$("$bin" --checkpoint="$file" "$(cat "$1")" 2>&1)"
+  second="$("$bin" --restore="$file" "$(cat "$1")" 2>&1)"
+  rm -f "$file"
+  echo "$first $second"
+}
+
+check checkpoint "15050145 5050145" restored "$dir/test32.c"
+
+# 局部数组在每次调用和每次循环迭代里都是独立的，返回时释放，递归不会改写调用者的数组
+check arrays "3530030000" "$bin" "$(cat "$dir/test33.c")"
+
+# 一行超过 64 KiB 的二维数组，下标的缩放不能截断
+check wide-rows "7999679999876543210" "$bin" "$(cat "$dir/test34.c")"
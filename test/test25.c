@@ -0,0 +1,14 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int sum(int n) {
+   if (n == 0)
+      return 0;
+   return n + sum(n - 1);
+}
+
+int main() {
+   PRINT(sum(500000));
+}
@@ -0,0 +1,12 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int f(int n) {
+   return f(n + 1) + 1;
+}
+
+int main() {
+   PRINT(f(0));
+}
@@ -0,0 +1,23 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+char toChar(int x) {
+   return x;
+}
+
+short toShort(int x) {
+   return x;
+}
+
+int main() {
+   char c = 300;
+   short s = 40000;
+   PRINT(c);
+   PRINT(s);
+   PRINT(toChar(300));
+   PRINT(toChar(-129));
+   PRINT(toShort(70000));
+   PRINT(c + 1);
+}
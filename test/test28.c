@@ -0,0 +1,42 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int find(int n) {
+   int i;
+   int j;
+   for (i = 1; i < n; i = i + 1) {
+      for (j = 1; j < n; j = j + 1) {
+         if (i * j == 12)
+            return i * 100 + j;
+      }
+   }
+   return -1;
+}
+
+int main() {
+   int i;
+   int j;
+   int sum;
+   sum = 0;
+   for (i = 0; i < 10; i = i + 1) {
+      if (i == 7)
+         break;
+      if (i % 2 == 1)
+         continue;
+      j = 0;
+      while (1) {
+         j = j + 1;
+         if (j > i)
+            break;
+         if (j == 3)
+            continue;
+         sum = sum + j;
+      }
+      PRINT(sum);
+   }
+   PRINT(i);
+   PRINT(find(10));
+   return 0;
+}
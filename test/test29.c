@@ -0,0 +1,40 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int main() {
+   int *a;
+   int *b;
+   int *c;
+   int i;
+   int bad;
+   a = (int *)MALLOC(100);
+   FREE(a);
+   b = (int *)MALLOC(100);
+   c = (int *)MALLOC(100);
+   PRINT(a == b);
+   PRINT(b == c);
+   FREE(b);
+   FREE(c);
+
+   bad = 0;
+   for (i = 0; i < 1000000; i = i + 1) {
+      a = (int *)MALLOC(8000);
+      a[1999] = i;
+      if (a[1999] != i)
+         bad = bad + 1;
+      FREE(a);
+   }
+   PRINT(bad);
+
+   for (i = 0; i < 100000; i = i + 1) {
+      a = (int *)MALLOC(100000);
+      a[24999] = i;
+      if (a[24999] != i)
+         bad = bad + 1;
+      FREE(a);
+   }
+   PRINT(bad);
+   return 0;
+}
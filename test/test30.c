@@ -0,0 +1,23 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int main() {
+   int **blocks;
+   int i;
+   int sum;
+   blocks = (int **)MALLOC(20000 * sizeof(int *));
+   for (i = 0; i < 20000; i = i + 1) {
+      blocks[i] = (int *)MALLOC(3 * sizeof(int));
+      blocks[i][0] = i;
+      blocks[i][2] = i * 2;
+   }
+   sum = 0;
+   for (i = 0; i < 20000; i = i + 1)
+      sum = sum + blocks[i][0] + blocks[i][2] - 3 * i;
+   PRINT(sum);
+   PRINT(blocks[12345][0]);
+   PRINT(blocks[19999][2]);
+   return 0;
+}
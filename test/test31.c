@@ -0,0 +1,29 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int count;
+
+int fib(int n) {
+   if (n < 2)
+      return n;
+   return fib(n - 1) + fib(n - 2);
+}
+
+int impure(int n) {
+   count = count + 1;
+   if (n == 0)
+      return 0;
+   return impure(n - 1) + 1;
+}
+
+int main() {
+   int i;
+   for (i = 0; i < 3; i = i + 1) {
+      PRINT(fib(24));
+      PRINT(impure(5));
+   }
+   PRINT(count);
+   return 0;
+}
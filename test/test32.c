@@ -0,0 +1,28 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+extern void CHECKPOINT();
+
+int sum(int n) {
+   if (n == 0) {
+      CHECKPOINT();
+      return 0;
+   }
+   return n + sum(n - 1);
+}
+
+int main() {
+   int a[5];
+   int *p;
+   int i;
+   p = (int *)MALLOC(10 * sizeof(int));
+   for (i = 0; i < 10; i = i + 1)
+      p[i] = i * i;
+   for (i = 0; i < 5; i = i + 1)
+      a[i] = i * i * i;
+   PRINT(1);
+   PRINT(sum(100));
+   PRINT(p[9] + a[4]);
+   return 0;
+}
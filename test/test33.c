@@ -0,0 +1,42 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int depthSum(int n) {
+   int a[3];
+   int s;
+   if (n == 0)
+      return 0;
+   a[0] = n;
+   a[1] = n * 2;
+   a[2] = n * 3;
+   s = depthSum(n - 1);
+   return s + a[0] + a[1] + a[2];
+}
+
+int last(int k) {
+   int t[10000];
+   t[9999] = k;
+   return t[9999];
+}
+
+int main() {
+   int i;
+   int j;
+   int total;
+   total = 0;
+   for (i = 0; i < 5; i = i + 1) {
+      int b[4];
+      for (j = 0; j < 4; j = j + 1)
+         b[j] = i + j;
+      total = total + b[0] + b[3];
+   }
+   PRINT(total);
+   PRINT(depthSum(1000));
+   total = 0;
+   for (i = 0; i < 120000; i = i + 1)
+      total = total + last(i) - i;
+   PRINT(total);
+   return 0;
+}
@@ -0,0 +1,30 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int main() {
+   int m[4][20000];
+   char rows[8][100000];
+   int i;
+   int j;
+   int total;
+   for (i = 0; i < 4; i = i + 1)
+      for (j = 0; j < 20000; j = j + 1)
+         m[i][j] = i * 20000 + j;
+   total = 0;
+   for (i = 0; i < 4; i = i + 1)
+      total = total + m[i][19999] - m[i][0];
+   PRINT(total);
+   PRINT(m[3][19999]);
+   for (i = 0; i < 8; i = i + 1) {
+      rows[i][0] = 9;
+      rows[i][99999] = i + 1;
+   }
+   total = 0;
+   for (i = 7; i >= 0; i = i - 1)
+      total = total * 10 + rows[i][99999];
+   PRINT(total);
+   PRINT(rows[7][1]);
+   return 0;
+}